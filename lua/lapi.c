@@ -117,6 +117,35 @@ LUA_API int lua_checkstack (lua_State *L, int n) {
 }
 
 
+/*
+** to be called by 'lua_reserve' in protected mode, to grow stack and
+** 'ci' list capturing memory errors
+*/
+static void reserve (lua_State *L, void *ud) {
+  int size = *(int *)ud;
+  if (L->stacksize < size)
+    luaD_reallocstack(L, size);
+  luaE_reserveCI(L, L->nciresv);
+}
+
+
+LUA_API int lua_reserve (lua_State *L, int n, int ncalls) {
+  int res;
+  lua_lock(L);
+  api_check(L, n >= 0 && ncalls >= 0, "negative reservation");
+  if (n > LUAI_MAXSTACK - EXTRA_STACK || ncalls > USHRT_MAX)
+    res = 0;  /* cannot be met */
+  else {
+    int size = n + EXTRA_STACK;
+    L->stackresv = size;
+    L->nciresv = cast(unsigned short, ncalls);
+    res = (luaD_rawrunprotected(L, &reserve, &size) == LUA_OK);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   int i;
   if (from == to) return;
@@ -494,6 +523,21 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+LUA_API const char *lua_pushexternalstring (lua_State *L, const char *s,
+                                            size_t len, lua_Alloc falloc,
+                                            void *ud) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, s[len] == '\0', "string not ending with zero");
+  ts = luaS_newextstr(L, s, len, falloc, ud);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -694,6 +738,7 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
     luaH_resize(L, t, narray, nrec);
+  t->keepsize = (nrec > 0);  /* asked for: the collector must not trim it */
   luaC_checkGC(L);
   lua_unlock(L);
 }
@@ -901,6 +946,20 @@ LUA_API void lua_setuservalue (lua_State *L, int idx) {
 }
 
 
+/*
+** removes all entries of the table at 'idx', keeping the memory of its
+** array and hash parts
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaH_clear(L, hvalue(o));
+  lua_unlock(L);
+}
+
+
 /*
 ** 'load' and 'call' functions (run Lua code)
 */
@@ -1103,6 +1162,12 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCRECYCLE: {
+      res = g->rcymax;
+      luaC_freerecycled(L);
+      g->rcymax = cast_byte((data < 0) ? 0 : (data > MAXRCY) ? MAXRCY : data);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
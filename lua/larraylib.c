@@ -0,0 +1,292 @@
+/*
+** Library for fixed-width integer arrays
+** See Copyright Notice in lua.h
+*/
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <string.h>
+#endif /* _KERNEL */
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define ARRAYHANDLE	"array"
+
+
+/* kinds of elements */
+enum { AU8, AU16, AU32, AI64 };
+
+static const char *const kindnames[] = {"u8", "u16", "u32", "i64", NULL};
+
+static const size_t kindsizes[] = {1, 2, 4, sizeof(lua_Integer)};
+
+
+typedef struct Array {
+  lua_Integer size;  /* number of elements */
+  int kind;
+  lua_Integer e[];  /* elements of any kind, aligned for the largest one */
+} Array;
+
+
+/*
+** all functions of the library have the metatable of arrays as their
+** first upvalue, so checking an argument is cheaper than a lookup for
+** the metatable in the registry, as 'luaL_checkudata' does; that
+** matters for '__index' and '__newindex', which run on every access
+*/
+static Array *checkarray (lua_State *L, int arg) {
+  void *p = lua_touserdata(L, arg);
+  if (p != NULL && lua_getmetatable(L, arg)) {
+    int ok = lua_rawequal(L, -1, lua_upvalueindex(1));
+    lua_pop(L, 1);
+    if (ok)
+      return (Array *)p;
+  }
+  luaL_checkudata(L, arg, ARRAYHANDLE);  /* raise the error */
+  return NULL;  /* to avoid warnings */
+}
+
+
+/*
+** runs 'code' with 'p' pointing to the elements of array 'a', typed
+** after its kind, so that loops over them are compiled once per kind
+*/
+#define forkind(a,p,code) \
+  switch ((a)->kind) { \
+    case AU8: { unsigned char *p = (unsigned char *)(a)->e; code; break; } \
+    case AU16: { unsigned short *p = (unsigned short *)(a)->e; code; break; } \
+    case AU32: { unsigned int *p = (unsigned int *)(a)->e; code; break; } \
+    default: { lua_Integer *p = (a)->e; code; break; } \
+  }
+
+
+/*
+** checks that integer 'v' fits in an element of array 'a'
+*/
+static lua_Integer checkvalue (lua_State *L, Array *a, int arg) {
+  lua_Integer v = luaL_checkinteger(L, arg);
+  switch (a->kind) {
+    case AU8: luaL_argcheck(L, 0 <= v && v <= 0xFF, arg,
+                            "value out of range"); break;
+    case AU16: luaL_argcheck(L, 0 <= v && v <= 0xFFFF, arg,
+                             "value out of range"); break;
+    case AU32: luaL_argcheck(L, 0 <= v && v <= 0xFFFFFFFF, arg,
+                             "value out of range"); break;
+  }
+  return v;
+}
+
+
+/*
+** gets the optional range [i, j] at arguments 'arg' and 'arg + 1',
+** which defaults to the whole array and must lie within it (unless
+** empty)
+*/
+static void checkrange (lua_State *L, Array *a, int arg,
+                        lua_Integer *i, lua_Integer *j) {
+  *i = luaL_optinteger(L, arg, 1);
+  *j = luaL_optinteger(L, arg + 1, a->size);
+  if (*i <= *j) {
+    luaL_argcheck(L, *i >= 1, arg, "out of bounds");
+    luaL_argcheck(L, *j <= a->size, arg + 1, "out of bounds");
+  }
+}
+
+
+static int anew (lua_State *L) {
+  int kind = luaL_checkoption(L, 1, NULL, kindnames);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  size_t head = offsetof(Array, e);
+  size_t esize = kindsizes[kind];
+  Array *a;
+  luaL_argcheck(L, 0 <= n && (lua_Unsigned)n <= (~(size_t)0 - head) / esize,
+                   2, "invalid size");
+  a = (Array *)lua_newuserdata(L, head + (size_t)n * esize);
+  a->size = n;
+  a->kind = kind;
+  memset(a->e, 0, (size_t)n * esize);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+
+/*
+** a[i]: integer keys are elements; other keys are methods
+*/
+static int aindex (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, 1 <= i && i <= a->size, 2, "index out of bounds");
+    i--;
+    forkind(a, p, lua_pushinteger(L, (lua_Integer)p[i]));
+  }
+  else {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(2));  /* methods[k] */
+  }
+  return 1;
+}
+
+
+static int anewindex (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  lua_Integer v = checkvalue(L, a, 3);
+  luaL_argcheck(L, 1 <= i && i <= a->size, 2, "index out of bounds");
+  i--;
+  forkind(a, p, p[i] = v);
+  return 0;
+}
+
+
+static int alen (lua_State *L) {
+  lua_pushinteger(L, checkarray(L, 1)->size);
+  return 1;
+}
+
+
+static int atostring (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  lua_pushfstring(L, ARRAYHANDLE " %s[%I] (%p)", kindnames[a->kind],
+                     a->size, a);
+  return 1;
+}
+
+
+/*
+** a:fill(v [, i [, j]]) sets a[i..j] to 'v'
+*/
+static int afill (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  lua_Integer v = checkvalue(L, a, 2);
+  lua_Integer i, j, k;
+  checkrange(L, a, 3, &i, &j);
+  forkind(a, p, for (k = i - 1; k < j; k++) p[k] = v);
+  return 0;
+}
+
+
+/*
+** a:sum([i [, j]]) returns the sum of a[i..j] (wrapping around, as
+** integer arithmetic does)
+*/
+static int asum (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  lua_Unsigned s = 0;
+  lua_Integer i, j, k;
+  checkrange(L, a, 2, &i, &j);
+  forkind(a, p, for (k = i - 1; k < j; k++) s += (lua_Unsigned)p[k]);
+  lua_pushinteger(L, (lua_Integer)s);
+  return 1;
+}
+
+
+/*
+** returns the smallest (or largest, if 'max') element of a[i..j] and its
+** index (the first one, if repeated), or nothing if the range is empty
+*/
+static int minmax (lua_State *L, int max) {
+  Array *a = checkarray(L, 1);
+  lua_Integer i, j, k, m;
+  lua_Integer im;
+  checkrange(L, a, 2, &i, &j);
+  if (i > j) return 0;  /* empty range */
+  im = i - 1;
+  if (max)
+    forkind(a, p, for (k = im + 1; k < j; k++) if (p[k] > p[im]) im = k)
+  else
+    forkind(a, p, for (k = im + 1; k < j; k++) if (p[k] < p[im]) im = k)
+  forkind(a, p, m = (lua_Integer)p[im]);
+  lua_pushinteger(L, m);
+  lua_pushinteger(L, im + 1);
+  return 2;
+}
+
+
+static int amin (lua_State *L) {
+  return minmax(L, 0);
+}
+
+
+static int amax (lua_State *L) {
+  return minmax(L, 1);
+}
+
+
+/*
+** a:copy(s [, i]) copies the elements packed in string 's', in native
+** byte order, to a[i..] ('i' defaults to 1)
+*/
+static int acopy (lua_State *L) {
+  Array *a = checkarray(L, 1);
+  size_t l;
+  const char *s = luaL_checklstring(L, 2, &l);
+  lua_Integer i = luaL_optinteger(L, 3, 1);
+  size_t esize = kindsizes[a->kind];
+  size_t n = l / esize;
+  luaL_argcheck(L, l % esize == 0, 2, "length not a multiple of element size");
+  luaL_argcheck(L, 1 <= i && (lua_Unsigned)(i - 1) + n <= (lua_Unsigned)a->size,
+                   3, "out of bounds");
+  memcpy((char *)a->e + (size_t)(i - 1) * esize, s, l);
+  return 0;
+}
+
+
+static const luaL_Reg meth[] = {
+  {"fill", afill},
+  {"sum", asum},
+  {"min", amin},
+  {"max", amax},
+  {"copy", acopy},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg metameth[] = {
+  {"__newindex", anewindex},
+  {"__len", alen},
+  {"__tostring", atostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg array_funcs[] = {
+  {"new", anew},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, ARRAYHANDLE);  /* create metatable for arrays */
+  lua_pushvalue(L, -1);
+  luaL_setfuncs(L, metameth, 1);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, meth, 1);
+  lua_pushvalue(L, -2);  /* metatable */
+  lua_insert(L, -2);  /* put it below the method table */
+  lua_pushcclosure(L, aindex, 2);  /* __index sees the methods */
+  lua_setfield(L, -2, "__index");
+}
+
+
+LUAMOD_API int luaopen_array (lua_State *L) {
+  createmeta(L);  /* leaves the metatable on the stack */
+  luaL_newlibtable(L, array_funcs);
+  lua_insert(L, -2);
+  luaL_setfuncs(L, array_funcs, 1);
+  return 1;
+}
+
@@ -30,6 +30,10 @@
 
 #include "lauxlib.h"
 
+#ifdef _KERNEL
+#include "lunatik.h"
+#endif /* _KERNEL */
+
 
 /*
 ** {======================================================
@@ -1019,6 +1023,7 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s, const char *p,
 }
 
 
+#ifndef _KERNEL
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   (void)ud; (void)osize;  /* not used */
   if (nsize == 0) {
@@ -1028,6 +1033,7 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   else
     return realloc(ptr, nsize);
 }
+#endif /* _KERNEL */
 
 
 #ifndef _KERNEL
@@ -1042,10 +1048,11 @@ static int l_panic (lua_State *L) {
 
 
 LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
 #ifndef _KERNEL
+  lua_State *L = lua_newstate(l_alloc, NULL);
   if (L) lua_atpanic(L, &panic);
 #else
+  lua_State *L = lunatik_newstate();  /* per-state slab allocator */
   if (L) lua_atpanic(L, &l_panic);
 #endif /* _KERNEL */
   return L;
@@ -0,0 +1,448 @@
+/*
+** Library for bitsets
+** See Copyright Notice in lua.h
+*/
+
+#define lbitsetlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#ifndef _KERNEL
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#endif /* _KERNEL */
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** {==================================================================
+** Bitmaps: the kernel's helpers, or their equivalents in userspace
+** ===================================================================
+*/
+#if defined(_KERNEL)	/* { */
+
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+
+#else			/* }{ */
+
+#define BITS_PER_LONG		((int)(sizeof(unsigned long) * CHAR_BIT))
+#define BITS_TO_LONGS(n)	(((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+/* mask of the bits of a word from bit 'start' on */
+#define FIRST_MASK(start)	(~0UL << ((start) % BITS_PER_LONG))
+/* mask of the bits of the last word of a bitmap of 'nbits' */
+#define LAST_MASK(nbits)	(~0UL >> (-(nbits) % BITS_PER_LONG))
+
+#if defined(__GNUC__)
+#define hweight_long(w)		((unsigned long)__builtin_popcountl(w))
+#define __ffs(w)		((unsigned long)__builtin_ctzl(w))
+#else
+
+static unsigned long hweight_long (unsigned long w) {
+  unsigned long n = 0;
+  for (; w != 0; w &= w - 1) n++;
+  return n;
+}
+
+static unsigned long __ffs (unsigned long w) {
+  unsigned long n = 0;
+  while (!(w & 1)) { w >>= 1; n++; }
+  return n;
+}
+
+#endif
+
+
+static int test_bit (unsigned int nr, const unsigned long *addr) {
+  return (addr[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+
+static void bitmap_set (unsigned long *map, unsigned int start,
+                        unsigned int len) {
+  unsigned int end = start + len;
+  for (; start < end && start % BITS_PER_LONG != 0; start++)
+    map[BIT_WORD(start)] |= BIT_MASK(start);
+  for (; start + BITS_PER_LONG <= end; start += BITS_PER_LONG)
+    map[BIT_WORD(start)] = ~0UL;
+  for (; start < end; start++)
+    map[BIT_WORD(start)] |= BIT_MASK(start);
+}
+
+
+static void bitmap_clear (unsigned long *map, unsigned int start,
+                          unsigned int len) {
+  unsigned int end = start + len;
+  for (; start < end && start % BITS_PER_LONG != 0; start++)
+    map[BIT_WORD(start)] &= ~BIT_MASK(start);
+  for (; start + BITS_PER_LONG <= end; start += BITS_PER_LONG)
+    map[BIT_WORD(start)] = 0;
+  for (; start < end; start++)
+    map[BIT_WORD(start)] &= ~BIT_MASK(start);
+}
+
+
+static unsigned int bitmap_weight (const unsigned long *src,
+                                   unsigned int nbits) {
+  unsigned int k, n = 0;
+  for (k = 0; k < nbits / BITS_PER_LONG; k++)
+    n += hweight_long(src[k]);
+  if (nbits % BITS_PER_LONG)
+    n += hweight_long(src[k] & LAST_MASK(nbits));
+  return n;
+}
+
+
+static void bitmap_or (unsigned long *dst, const unsigned long *src1,
+                       const unsigned long *src2, unsigned int nbits) {
+  unsigned int k;
+  for (k = 0; k < BITS_TO_LONGS(nbits); k++)
+    dst[k] = src1[k] | src2[k];
+}
+
+
+static void bitmap_and (unsigned long *dst, const unsigned long *src1,
+                        const unsigned long *src2, unsigned int nbits) {
+  unsigned int k;
+  for (k = 0; k < BITS_TO_LONGS(nbits); k++)
+    dst[k] = src1[k] & src2[k];
+}
+
+
+static void bitmap_andnot (unsigned long *dst, const unsigned long *src1,
+                           const unsigned long *src2, unsigned int nbits) {
+  unsigned int k;
+  for (k = 0; k < BITS_TO_LONGS(nbits); k++)
+    dst[k] = src1[k] & ~src2[k];
+}
+
+
+static unsigned long find_next_bit (const unsigned long *addr,
+                                    unsigned long size,
+                                    unsigned long offset) {
+  unsigned long w;
+  if (offset >= size)
+    return size;
+  w = addr[BIT_WORD(offset)] & FIRST_MASK(offset);
+  offset -= offset % BITS_PER_LONG;
+  while (w == 0) {
+    offset += BITS_PER_LONG;
+    if (offset >= size)
+      return size;
+    w = addr[BIT_WORD(offset)];
+  }
+  offset += __ffs(w);
+  return (offset < size) ? offset : size;
+}
+
+#endif			/* } */
+/* }================================================================== */
+
+
+#define BITSETHANDLE	"bitset"
+
+
+/* bits beyond 'n' in the last word are always 0 */
+typedef struct Bitset {
+  lua_Integer n;  /* number of bits */
+  unsigned long w[];
+} Bitset;
+
+
+/*
+** all functions of the library have the metatable of bitsets as their
+** first upvalue (see 'checkarray' in larraylib.c)
+*/
+static Bitset *checkbitset (lua_State *L, int arg) {
+  void *p = lua_touserdata(L, arg);
+  if (p != NULL && lua_getmetatable(L, arg)) {
+    int ok = lua_rawequal(L, -1, lua_upvalueindex(1));
+    lua_pop(L, 1);
+    if (ok)
+      return (Bitset *)p;
+  }
+  luaL_checkudata(L, arg, BITSETHANDLE);  /* raise the error */
+  return NULL;  /* to avoid warnings */
+}
+
+
+static unsigned int checkbit (lua_State *L, Bitset *b, int arg) {
+  lua_Integer i = luaL_checkinteger(L, arg);
+  luaL_argcheck(L, 0 <= i && i < b->n, arg, "bit out of range");
+  return (unsigned int)i;
+}
+
+
+#define wordsize(n)	((size_t)BITS_TO_LONGS(n) * sizeof(unsigned long))
+
+
+static Bitset *newbitset (lua_State *L, lua_Integer n) {
+  Bitset *b = (Bitset *)lua_newuserdata(L, offsetof(Bitset, w) + wordsize(n));
+  b->n = n;
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_setmetatable(L, -2);
+  return b;
+}
+
+
+static int bnew (lua_State *L) {
+  lua_Integer n = luaL_checkinteger(L, 1);
+  Bitset *b;
+  luaL_argcheck(L, 0 <= n && n <= INT_MAX, 1, "invalid size");
+  b = newbitset(L, n);
+  memset(b->w, 0, wordsize(n));
+  return 1;
+}
+
+
+/*
+** gets the range [i, j] of bits for 'b:set' and 'b:clear': all bits if
+** there are no arguments, bit 'i' if there is no 'j'
+*/
+static unsigned int getrange (lua_State *L, Bitset *b, unsigned int *i) {
+  unsigned int j;
+  if (lua_isnoneornil(L, 2)) {
+    *i = 0;
+    return (unsigned int)b->n;
+  }
+  *i = checkbit(L, b, 2);
+  j = lua_isnoneornil(L, 3) ? *i : checkbit(L, b, 3);
+  return (*i <= j) ? j - *i + 1 : 0;
+}
+
+
+/*
+** b:set([i [, j]]) sets bits i to j (or bit i, or all bits)
+*/
+static int bset (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  unsigned int i, len = getrange(L, b, &i);
+  bitmap_set(b->w, i, len);
+  return 0;
+}
+
+
+/*
+** b:clear([i [, j]]) clears bits i to j (or bit i, or all bits)
+*/
+static int bclear (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  unsigned int i, len = getrange(L, b, &i);
+  bitmap_clear(b->w, i, len);
+  return 0;
+}
+
+
+static int btest (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_pushboolean(L, test_bit(checkbit(L, b, 2), b->w));
+  return 1;
+}
+
+
+static int bcount (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_pushinteger(L, bitmap_weight(b->w, (unsigned int)b->n));
+  return 1;
+}
+
+
+/*
+** b:rank(i) returns the number of bits set before bit 'i' (which may be
+** the size of the bitset)
+*/
+static int brank (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= i && i <= b->n, 2, "bit out of range");
+  lua_pushinteger(L, bitmap_weight(b->w, (unsigned int)i));
+  return 1;
+}
+
+
+/*
+** b:select(k) returns the position of the k-th bit set (from 1), or nil
+*/
+static int bselect (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_Integer k = luaL_checkinteger(L, 2);
+  size_t i, nw = BITS_TO_LONGS(b->n);
+  luaL_argcheck(L, k >= 1, 2, "out of range");
+  for (i = 0; i < nw; i++) {
+    unsigned long w = b->w[i];
+    lua_Integer c = (lua_Integer)hweight_long(w);
+    if (k > c)
+      k -= c;
+    else {
+      for (; k > 1; k--)
+        w &= w - 1;  /* clear lowest bit set */
+      lua_pushinteger(L, (lua_Integer)(i * BITS_PER_LONG + __ffs(w)));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** b:next([i]) returns the first bit set from bit 'i' (0 by default) on,
+** or nil
+*/
+static int bnext (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_Integer i = luaL_optinteger(L, 2, 0);
+  unsigned long r;
+  luaL_argcheck(L, i >= 0, 2, "bit out of range");
+  if (i >= b->n)
+    return 0;
+  r = find_next_bit(b->w, (unsigned long)b->n, (unsigned long)i);
+  if (r >= (unsigned long)b->n)
+    return 0;
+  lua_pushinteger(L, (lua_Integer)r);
+  return 1;
+}
+
+
+static int bitsaux (lua_State *L) {
+  lua_Integer i = luaL_checkinteger(L, 2) + 1;
+  lua_settop(L, 1);
+  lua_pushinteger(L, i);
+  return bnext(L);
+}
+
+
+/*
+** b:bits() returns an iterator over the bits set, for a generic 'for'
+*/
+static int bbits (lua_State *L) {
+  checkbitset(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(2));  /* 'bitsaux' */
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, -1);
+  return 3;
+}
+
+
+static Bitset *checkother (lua_State *L, Bitset *b) {
+  Bitset *o = checkbitset(L, 2);
+  luaL_argcheck(L, o->n == b->n, 2, "bitsets of different sizes");
+  return o;
+}
+
+
+/*
+** b:union(o), b:intersection(o) and b:difference(o) change 'b' to the
+** union, intersection or difference of 'b' and 'o' and return 'b'
+*/
+static int bunion (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  Bitset *o = checkother(L, b);
+  bitmap_or(b->w, b->w, o->w, (unsigned int)b->n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int bintersection (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  Bitset *o = checkother(L, b);
+  bitmap_and(b->w, b->w, o->w, (unsigned int)b->n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int bdifference (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  Bitset *o = checkother(L, b);
+  bitmap_andnot(b->w, b->w, o->w, (unsigned int)b->n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int bclone (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  Bitset *c = newbitset(L, b->n);
+  memcpy(c->w, b->w, wordsize(b->n));
+  return 1;
+}
+
+
+static int blen (lua_State *L) {
+  lua_pushinteger(L, checkbitset(L, 1)->n);
+  return 1;
+}
+
+
+static int btostring (lua_State *L) {
+  Bitset *b = checkbitset(L, 1);
+  lua_pushfstring(L, BITSETHANDLE " [%I] (%p)", b->n, b);
+  return 1;
+}
+
+
+static const luaL_Reg meth[] = {
+  {"set", bset},
+  {"clear", bclear},
+  {"test", btest},
+  {"count", bcount},
+  {"rank", brank},
+  {"select", bselect},
+  {"next", bnext},
+  {"union", bunion},
+  {"intersection", bintersection},
+  {"difference", bdifference},
+  {"clone", bclone},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg metameth[] = {
+  {"__len", blen},
+  {"__tostring", btostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg bitset_funcs[] = {
+  {"new", bnew},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, BITSETHANDLE);  /* create metatable for bitsets */
+  lua_pushvalue(L, -1);
+  luaL_setfuncs(L, metameth, 1);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, meth, 1);
+  lua_pushvalue(L, -2);  /* metatable */
+  lua_pushvalue(L, -1);
+  lua_pushcclosure(L, bitsaux, 1);
+  lua_pushcclosure(L, bbits, 2);  /* 'bits' sees the iterator */
+  lua_setfield(L, -2, "bits");
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+}
+
+
+LUAMOD_API int luaopen_bitset (lua_State *L) {
+  createmeta(L);  /* leaves the metatable on the stack */
+  luaL_newlibtable(L, bitset_funcs);
+  lua_insert(L, -2);
+  luaL_setfuncs(L, bitset_funcs, 1);
+  return 1;
+}
+
@@ -557,6 +557,28 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Check whether R/K index 'idx' is a constant short string, which
+** can be used as the key of OP_GETFIELD/OP_SETFIELD.
+*/
+static int isKstr (FuncState *fs, int idx) {
+  return (ISK(idx) && ttisshrstring(&fs->f->k[INDEXK(idx)]));
+}
+
+
+/*
+** Check whether R/K index 'idx' is a constant integer in the range
+** [0, max], which can be used as the index of OP_GETI/OP_SETI.
+*/
+static int isKint (FuncState *fs, int idx, int max) {
+  const TValue *k;
+  if (!ISK(idx))
+    return 0;
+  k = &fs->f->k[INDEXK(idx)];
+  return (ttisinteger(k) && l_castS2U(ivalue(k)) <= cast(lua_Unsigned, max));
+}
+
+
 /*
 ** Ensure that expression 'e' is not a variable.
 */
@@ -573,16 +595,26 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
     }
     case VINDEXED: {
       OpCode op;
-      freereg(fs, e->u.ind.idx);
+      int idx = e->u.ind.idx;
+      freereg(fs, idx);
       if (e->u.ind.vt == VLOCAL) {  /* is 't' in a register? */
         freereg(fs, e->u.ind.t);
-        op = OP_GETTABLE;
+        if (isKstr(fs, idx)) {  /* 't.field'? */
+          op = OP_GETFIELD;
+          idx = INDEXK(idx);
+        }
+        else if (isKint(fs, idx, MAXARG_C)) {  /* 't[n]' for a small 'n'? */
+          op = OP_GETI;
+          idx = cast_int(ivalue(&fs->f->k[INDEXK(idx)]));
+        }
+        else
+          op = OP_GETTABLE;
       }
       else {
         lua_assert(e->u.ind.vt == VUPVAL);
         op = OP_GETTABUP;  /* 't' is in an upvalue */
       }
-      e->u.info = luaK_codeABC(fs, op, 0, e->u.ind.t, e->u.ind.idx);
+      e->u.info = luaK_codeABC(fs, op, 0, e->u.ind.t, idx);
       e->k = VRELOCABLE;
       break;
     }
@@ -804,8 +836,19 @@ void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
     }
     case VINDEXED: {
       OpCode op = (var->u.ind.vt == VLOCAL) ? OP_SETTABLE : OP_SETTABUP;
+      int idx = var->u.ind.idx;
       int e = luaK_exp2RK(fs, ex);
-      luaK_codeABC(fs, op, var->u.ind.t, var->u.ind.idx, e);
+      if (op == OP_SETTABLE) {
+        if (isKstr(fs, idx)) {  /* 't.field = e'? */
+          op = OP_SETFIELD;
+          idx = INDEXK(idx);
+        }
+        else if (isKint(fs, idx, MAXARG_B)) {  /* 't[n] = e'? */
+          op = OP_SETI;
+          idx = cast_int(ivalue(&fs->f->k[INDEXK(idx)]));
+        }
+      }
+      luaK_codeABC(fs, op, var->u.ind.t, idx, e);
       break;
     }
     default: lua_assert(0);  /* invalid var kind to store */
@@ -1057,14 +1100,75 @@ static void codebinexpval (FuncState *fs, OpCode op,
 }
 
 
+/*
+** Check whether expression 'e' is an integer constant that fits in
+** a signed immediate argument ('sC').
+*/
+static int isSCint (const expdesc *e) {
+  return (e->k == VKINT && !hasjumps(e) && fitsC(e->u.ival));
+}
+
+
+/*
+** Emit code for binary expressions with an immediate operand, where
+** 'e1' is in a register and 'e2' is an integer constant that fits in
+** argument 'sC' (see 'isSCint').
+*/
+static void codebinexpimm (FuncState *fs, OpCode op,
+                           expdesc *e1, const expdesc *e2, int line) {
+  int r1 = e1->u.info;
+  freeexp(fs, e1);
+  e1->u.info = luaK_codeABC(fs, op, 0, r1, int2sC(e2->u.ival));
+  e1->k = VRELOCABLE;
+  luaK_fixline(fs, line);
+}
+
+
+/*
+** Emit code for comparison '(r opr imm)', or '(imm opr r)' if 'inv'
+** is true, where 'r' is a register and 'imm' fits in argument 'sC'.
+** The operands of the immediate opcodes are never swapped, so
+** '(1 < r)' becomes '(r > 1)'.
+*/
+static int condjumpimm (FuncState *fs, BinOpr opr, int r, lua_Integer imm,
+                        int inv) {
+  OpCode op;
+  int cond = 1;
+  switch (opr) {
+    case OPR_NE: cond = 0;  /* '(a ~= b)' ==> 'not (a == b)' */
+      /* FALLTHROUGH */
+    case OPR_EQ: op = OP_EQI; break;
+    case OPR_LT: op = inv ? OP_GTI : OP_LTI; break;
+    case OPR_LE: op = inv ? OP_GEI : OP_LEI; break;
+    case OPR_GT: op = inv ? OP_LTI : OP_GTI; break;
+    default: lua_assert(opr == OPR_GE); op = inv ? OP_LEI : OP_GEI; break;
+  }
+  return condjump(fs, op, cond, r, int2sC(imm));
+}
+
+
 /*
 ** Emit code for comparisons.
-** 'e1' was already put in R/K form by 'luaK_infix'.
+** 'e1' was already put in R/K form by 'luaK_infix', unless it is a
+** numeral. A small integer operand is coded as an immediate when the
+** other one is in a register.
 */
 static void codecomp (FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
-  int rk1 = (e1->k == VK) ? RKASK(e1->u.info)
-                          : check_exp(e1->k == VNONRELOC, e1->u.info);
-  int rk2 = luaK_exp2RK(fs, e2);
+  int rk1, rk2;
+  if (e1->k == VNONRELOC && isSCint(e2)) {  /* '(r opr imm)'? */
+    freeexp(fs, e1);
+    e1->u.info = condjumpimm(fs, opr, e1->u.info, e2->u.ival, 0);
+    e1->k = VJMP;
+    return;
+  }
+  rk2 = luaK_exp2RK(fs, e2);  /* 'e2' first, as in 'codebinexpval' */
+  if (isSCint(e1) && !ISK(rk2)) {  /* '(imm opr r)'? */
+    freeexp(fs, e2);
+    e1->u.info = condjumpimm(fs, opr, rk2, e1->u.ival, 1);
+    e1->k = VJMP;
+    return;
+  }
+  rk1 = luaK_exp2RK(fs, e1);
   freeexps(fs, e1, e2);
   switch (opr) {
     case OPR_NE: {  /* '(a ~= b)' ==> 'not (a == b)' */
@@ -1139,6 +1243,13 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
       /* else keep numeral, which may be folded with 2nd operand */
       break;
     }
+    case OPR_EQ: case OPR_LT: case OPR_LE:
+    case OPR_NE: case OPR_GT: case OPR_GE: {
+      if (!tonumeral(v, NULL))
+        luaK_exp2RK(fs, v);
+      /* else keep numeral, which may be an immediate operand */
+      break;
+    }
     default: {
       luaK_exp2RK(fs, v);
       break;
@@ -1194,7 +1305,12 @@ void luaK_posfix (FuncState *fs, BinOpr op,
 #endif /* _KERNEL */
     case OPR_BAND: case OPR_BOR: case OPR_BXOR:
     case OPR_SHL: case OPR_SHR: {
-      if (!constfolding(fs, op + LUA_OPADD, e1, e2))
+      if (constfolding(fs, op + LUA_OPADD, e1, e2))
+        break;  /* done by folding */
+      if ((op == OPR_ADD || op == OPR_SUB) &&
+          e1->k == VNONRELOC && isSCint(e2))  /* 'r + imm' or 'r - imm'? */
+        codebinexpimm(fs, (op == OPR_ADD) ? OP_ADDI : OP_SUBI, e1, e2, line);
+      else
         codebinexpval(fs, cast(OpCode, op + OP_ADD), e1, e2, line);
       break;
     }
@@ -1238,3 +1354,34 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** Final pass over the code of a function: turn the first instruction
+** of each frequent pair into the superinstruction for the pair (see
+** 'vmfuse' in ljumptab.h). The second instruction stays where it is,
+** so that jumps, line information and 'findsetreg' still see it, and
+** a superinstruction may also start there.
+*/
+void luaK_finish (FuncState *fs) {
+#if LUA_USE_SUPERINSTR
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    switch (GET_OPCODE(code[pc])) {
+      case OP_MOVE:
+        if (next == OP_MOVE) SET_OPCODE(code[pc], OP_MOVE2);
+        break;
+      case OP_LOADK:
+        if (next == OP_LOADK) SET_OPCODE(code[pc], OP_LOADK2);
+        break;
+      case OP_GETFIELD:
+        if (next == OP_GETFIELD) SET_OPCODE(code[pc], OP_GETFIELD2);
+        break;
+      default: break;
+    }
+  }
+#else
+  UNUSED(fs);
+#endif
+}
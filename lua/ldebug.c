@@ -442,30 +442,39 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
     Instruction i = p->code[pc];
     OpCode op = GET_OPCODE(i);
     switch (op) {
-      case OP_MOVE: {
+      case OP_MOVE: case OP_MOVE2: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
         if (b < GETARG_A(i))
           return getobjname(p, pc, b, name);  /* get name for 'b' */
         break;
       }
       case OP_GETTABUP:
-      case OP_GETTABLE: {
-        int k = GETARG_C(i);  /* key index */
+      case OP_GETTABLE:
+      case OP_GETFIELD:
+      case OP_GETFIELD2: {
+        int k = (op == OP_GETFIELD || op == OP_GETFIELD2)
+                ? RKASK(GETARG_C(i))  /* key index (as a R/K value) */
+                : GETARG_C(i);
         int t = GETARG_B(i);  /* table index */
-        const char *vn = (op == OP_GETTABLE)  /* name of indexed variable */
+        const char *vn = (op != OP_GETTABUP)  /* name of indexed variable */
                          ? luaF_getlocalname(p, t + 1, pc)
                          : upvalname(p, t);
         kname(p, pc, k, name);
         return (vn && strcmp(vn, LUA_ENV) == 0) ? "global" : "field";
       }
+      case OP_GETI: {
+        *name = "?";  /* as 'kname' does for non-string constants */
+        return "field";
+      }
       case OP_GETUPVAL: {
         *name = upvalname(p, GETARG_B(i));
         return "upvalue";
       }
       case OP_LOADK:
+      case OP_LOADK2:
       case OP_LOADKX: {
-        int b = (op == OP_LOADK) ? GETARG_Bx(i)
-                                 : GETARG_Ax(p->code[pc + 1]);
+        int b = (op != OP_LOADKX) ? GETARG_Bx(i)
+                                  : GETARG_Ax(p->code[pc + 1]);
         if (ttisstring(&p->k[b])) {
           *name = svalue(&p->k[b]);
           return "constant";
@@ -510,11 +519,14 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     }
     /* other instructions can do calls through metamethods */
     case OP_SELF: case OP_GETTABUP: case OP_GETTABLE:
+    case OP_GETFIELD: case OP_GETI: case OP_GETFIELD2:
       tm = TM_INDEX;
       break;
-    case OP_SETTABUP: case OP_SETTABLE:
+    case OP_SETTABUP: case OP_SETTABLE: case OP_SETFIELD: case OP_SETI:
       tm = TM_NEWINDEX;
       break;
+    case OP_ADDI: tm = TM_ADD; break;
+    case OP_SUBI: tm = TM_SUB; break;
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
 #ifndef _KERNEL
     case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
@@ -531,8 +543,8 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     case OP_LEN: tm = TM_LEN; break;
     case OP_CONCAT: tm = TM_CONCAT; break;
     case OP_EQ: tm = TM_EQ; break;
-    case OP_LT: tm = TM_LT; break;
-    case OP_LE: tm = TM_LE; break;
+    case OP_LT: case OP_LTI: case OP_GTI: tm = TM_LT; break;
+    case OP_LE: case OP_LEI: case OP_GEI: tm = TM_LE; break;
     default:
       return NULL;  /* cannot find a reasonable name */
   }
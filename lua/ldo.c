@@ -236,10 +236,12 @@ static int stackinuse (lua_State *L) {
 void luaD_shrinkstack (lua_State *L) {
   int inuse = stackinuse(L);
   int goodsize = inuse + (inuse / 8) + 2*EXTRA_STACK;
+  if (goodsize < L->stackresv)
+    goodsize = L->stackresv;  /* keep the reserved size */
   if (goodsize > LUAI_MAXSTACK)
     goodsize = LUAI_MAXSTACK;  /* respect stack limit */
   if (L->stacksize > LUAI_MAXSTACK)  /* had been handling stack overflow? */
-    luaE_freeCI(L);  /* free all CIs (list grew because of an error) */
+    luaE_freeCI(L);  /* free extra CIs (list grew because of an error) */
   else
     luaE_shrinkCI(L);  /* shrink list */
   /* if thread is currently not handling a stack overflow and its
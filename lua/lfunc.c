@@ -47,7 +47,7 @@ LClosure *luaF_newLclosure (lua_State *L, int n) {
 void luaF_initupvals (lua_State *L, LClosure *cl) {
   int i;
   for (i = 0; i < cl->nupvalues; i++) {
-    UpVal *uv = luaM_new(L, UpVal);
+    UpVal *uv = cast(UpVal *, luaC_newblock(L, sizeof(UpVal), RCY_UPVAL));
     uv->refcount = 1;
     uv->v = &uv->u.value;  /* make it closed */
     setnilvalue(uv->v);
@@ -68,7 +68,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
     pp = &p->u.open.next;
   }
   /* not found: create a new upvalue */
-  uv = luaM_new(L, UpVal);
+  uv = cast(UpVal *, luaC_newblock(L, sizeof(UpVal), RCY_UPVAL));
   uv->refcount = 0;
   uv->u.open.next = *pp;  /* link it to list of open upvalues */
   uv->u.open.touched = 1;
@@ -88,7 +88,7 @@ void luaF_close (lua_State *L, StkId level) {
     lua_assert(upisopen(uv));
     L->openupval = uv->u.open.next;  /* remove from 'open' list */
     if (uv->refcount == 0)  /* no references? */
-      luaM_free(L, uv);  /* free upvalue */
+      luaC_freeblock(L, uv, sizeof(UpVal), RCY_UPVAL);  /* free upvalue */
     else {
       setobj(L, &uv->u.value, uv->v);  /* move value to upvalue slot */
       uv->v = &uv->u.value;  /* now current value lives here */
@@ -107,6 +107,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->kcache = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -128,6 +129,8 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
+  if (f->kcache != NULL)  /* not left incomplete by an error? */
+    luaM_freearray(L, f->kcache, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
@@ -135,6 +138,20 @@ void luaF_freeproto (lua_State *L, Proto *f) {
 }
 
 
+/*
+** Create the inline caches for the (final) constants of 'f'
+*/
+void luaF_newkcache (lua_State *L, Proto *f) {
+  int i;
+  f->kcache = luaM_newvector(L, f->sizek, KCache);
+  for (i = 0; i < f->sizek; i++) {
+    KCache *kc = &f->kcache[i];
+    kc->layout = kc->mtlayout = 0;  /* no table has layout 0 */
+    kc->slot = kc->index = NULL;
+  }
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -109,6 +109,29 @@ static void reallymarkobject (global_State *g, GCObject *o);
 #define gnodelast(h)	gnode(h, cast(size_t, sizenode(h)))
 
 
+/*
+** loop over all nodes of table 'h': its hash part and, while it is
+** being migrated, the nodes of the previous hash part not moved yet
+*/
+#define fornodes(h,r,n,limit) \
+  for (r = 0; noderange(h, r, &n, &limit); r++) \
+    for (; n < limit; n++)
+
+static int noderange (Table *h, int r, Node **n, Node **limit) {
+  if (r == 0) {
+    *n = gnode(h, 0);
+    *limit = gnodelast(h);
+    return 1;
+  }
+  else if (r == 1 && ismigrating(h)) {
+    *n = h->oldnode + h->moved;
+    *limit = h->oldnode + sizeold(h);
+    return 1;
+  }
+  return 0;
+}
+
+
 /*
 ** link collectable object 'o' into list pointed by 'p'
 */
@@ -203,13 +226,101 @@ void luaC_fix (lua_State *L, GCObject *o) {
 }
 
 
+/*
+** {======================================================
+** Recycling of dead blocks
+** =======================================================
+*/
+
+/*
+** returns the list of recycled blocks for objects of type 'tt' with
+** size 'sz', or -1 if such objects are not recycled
+*/
+static int rcylist (int tt, size_t sz) {
+  switch (tt) {
+    case LUA_TTABLE: return RCY_TABLE;
+    case LUA_TLCL: {
+      size_t n = (sz - sizeLclosure(0)) / sizeof(UpVal *);
+      return (n <= MAXRCYUPVALS) ? RCY_LCL + cast_int(n) : -1;
+    }
+    case LUA_TSHRSTR: return RCY_SHRSTR + cast_int(sz - sizelstring(0));
+    default: return -1;
+  }
+}
+
+
+static void *reuseblock (global_State *g, int l) {
+  void *b = g->rcylist[l];
+  if (b != NULL) {
+    g->rcylist[l] = *cast(void **, b);
+    g->rcycount[l]--;
+  }
+  return b;
+}
+
+
+/*
+** allocate a block of size 'sz', taking it from list 'l' of recycled
+** blocks when possible
+*/
+void *luaC_newblock (lua_State *L, size_t sz, int l) {
+  void *b = reuseblock(G(L), l);
+  return (b != NULL) ? b : luaM_malloc(L, sz);
+}
+
+
+/*
+** release a block of size 'sz'; if list 'l' is not full, keep the
+** block there to be reused (its memory is still counted as in use)
+*/
+void luaC_freeblock (lua_State *L, void *b, size_t sz, int l) {
+  global_State *g = G(L);
+  if (l >= 0 && g->rcycount[l] < g->rcymax) {
+    *cast(void **, b) = g->rcylist[l];
+    g->rcylist[l] = b;
+    g->rcycount[l]++;
+  }
+  else
+    luaM_freemem(L, b, sz);
+}
+
+
+static size_t rcysize (int l) {
+  if (l == RCY_TABLE) return sizeof(Table);
+  else if (l == RCY_UPVAL) return sizeof(UpVal);
+  else if (l < RCY_SHRSTR) return sizeLclosure(l - RCY_LCL);
+  else return sizelstring(l - RCY_SHRSTR);
+}
+
+
+/*
+** give all recycled blocks back to the allocator
+*/
+void luaC_freerecycled (lua_State *L) {
+  global_State *g = G(L);
+  l_mem olddebt = g->GCdebt;
+  int l;
+  for (l = 0; l < RCY_N; l++) {
+    void *b;
+    while ((b = reuseblock(g, l)) != NULL)
+      luaM_freemem(L, b, rcysize(l));
+  }
+  g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+}
+
+/* }====================================================== */
+
+
 /*
 ** create a new collectable object (with given type and size) and link
 ** it to 'allgc' list.
 */
 GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   global_State *g = G(L);
-  GCObject *o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
+  int l = rcylist(tt, sz);
+  GCObject *o = (l >= 0) ? cast(GCObject *, reuseblock(g, l)) : NULL;
+  if (o == NULL)
+    o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
   o->marked = luaC_white(g);
   o->tt = tt;
   o->next = g->allgc;
@@ -245,7 +356,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TLNGSTR: {
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += sizelngstr(gco2ts(o));
       break;
     }
     case LUA_TUSERDATA: {
@@ -361,11 +472,12 @@ static void restartcollection (global_State *g) {
 ** put it in 'weak' list, to be cleared.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int r;
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   int hasclears = (h->sizearray > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  fornodes(h, r, n, limit) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -397,8 +509,9 @@ static int traverseephemeron (global_State *g, Table *h) {
   int marked = 0;  /* true if an object is marked in this traversal */
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
   unsigned int i;
+  int r;
   /* traverse array part */
   for (i = 0; i < h->sizearray; i++) {
     if (valiswhite(&h->array[i])) {
@@ -407,7 +520,7 @@ static int traverseephemeron (global_State *g, Table *h) {
     }
   }
   /* traverse hash part */
-  for (n = gnode(h, 0); n < limit; n++) {
+  fornodes(h, r, n, limit) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -433,11 +546,12 @@ static int traverseephemeron (global_State *g, Table *h) {
 
 
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
   unsigned int i;
+  int r;
   for (i = 0; i < h->sizearray; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  fornodes(h, r, n, limit) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -469,7 +583,8 @@ static lu_mem traversetable (global_State *g, Table *h) {
   else  /* not weak */
     traversestrongtable(g, h);
   return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+                         sizenodevector(allocsizenode(h)) +
+                         (ismigrating(h) ? sizenodevector(sizeold(h)) : 0);
 }
 
 
@@ -494,6 +609,7 @@ static int traverseproto (global_State *g, Proto *f) {
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
+                         (f->kcache != NULL ? sizeof(KCache) * f->sizek : 0) +
                          sizeof(int) * f->sizelineinfo +
                          sizeof(LocVar) * f->sizelocvars +
                          sizeof(Upvaldesc) * f->sizeupvalues;
@@ -641,8 +757,9 @@ static void convergeephemerons (global_State *g) {
 static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++) {
+    Node *n, *limit;
+    int r;
+    fornodes(h, r, n, limit) {
       if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
@@ -659,14 +776,15 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
 static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
     unsigned int i;
+    int r;
     for (i = 0; i < h->sizearray; i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
+    fornodes(h, r, n, limit) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
@@ -680,7 +798,7 @@ void luaC_upvdeccount (lua_State *L, UpVal *uv) {
   lua_assert(uv->refcount > 0);
   uv->refcount--;
   if (uv->refcount == 0 && !upisopen(uv))
-    luaM_free(L, uv);
+    luaC_freeblock(L, uv, sizeof(UpVal), RCY_UPVAL);
 }
 
 
@@ -691,7 +809,8 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
     if (uv)
       luaC_upvdeccount(L, uv);
   }
-  luaM_freemem(L, cl, sizeLclosure(cl->nupvalues));
+  luaC_freeblock(L, cl, sizeLclosure(cl->nupvalues),
+                 rcylist(LUA_TLCL, sizeLclosure(cl->nupvalues)));
 }
 
 
@@ -711,10 +830,15 @@ static void freeobj (lua_State *L, GCObject *o) {
     case LUA_TUSERDATA: luaM_freemem(L, o, sizeudata(gco2u(o))); break;
     case LUA_TSHRSTR:
       luaS_remove(L, gco2ts(o));  /* remove it from hash table */
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
+      luaC_freeblock(L, o, sizelstring(gco2ts(o)->shrlen),
+                     RCY_SHRSTR + gco2ts(o)->shrlen);
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+      TString *ts = gco2ts(o);
+      if (isextstr(ts) && extstr(ts)->falloc != NULL)  /* release bytes */
+        (*extstr(ts)->falloc)(extstr(ts)->ud, cast(void *, getstr(ts)),
+                              ts->u.lnglen + 1, 0);
+      luaM_freemem(L, o, sizelngstr(ts));
       break;
     }
     default: lua_assert(0);
@@ -746,6 +870,8 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
     }
     else {  /* change mark to 'white' */
       curr->marked = cast_byte((marked & maskcolors) | white);
+      if (g->gcshrink && curr->tt == LUA_TTABLE)
+        luaH_trim(L, gco2t(curr));  /* shrink a mostly empty hash part */
       p = &curr->next;  /* go to next element */
     }
   }
@@ -779,7 +905,8 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 static void checkSizes (lua_State *L, global_State *g) {
   if (g->gckind != KGC_EMERGENCY) {
     l_mem olddebt = g->GCdebt;
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
+    if (g->strt.old == NULL &&  /* not resizing already? */
+        g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
@@ -973,9 +1100,11 @@ void luaC_freeallobjects (lua_State *L) {
   lua_assert(g->tobefnz == NULL);
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
+  g->rcymax = 0;  /* do not recycle anything else */
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
+  luaC_freerecycled(L);
   lua_assert(g->strt.nuse == 0);
 }
 
@@ -1032,6 +1161,7 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
   if (g->sweepgc) {
     l_mem olddebt = g->GCdebt;
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+    luaS_migrate(L, GCSWEEPMAX);  /* help a pending string-table resize */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
     if (g->sweepgc)  /* is there still something to sweep? */
       return (GCSWEEPMAX * GCSWEEPCOST);
@@ -1047,7 +1177,7 @@ static lu_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
-      g->GCmemtrav = g->strt.size * sizeof(GCObject*);
+      g->GCmemtrav = (g->strt.size + g->strt.oldsize) * sizeof(GCObject*);
       restartcollection(g);
       g->gcstate = GCSpropagate;
       return g->GCmemtrav;
@@ -1148,6 +1278,43 @@ void luaC_step (lua_State *L) {
 }
 
 
+/*
+** Gives memory back while the state is idle: advances the current
+** cycle by at most 'work' units as an emergency collection (so no
+** finalizer runs and no object moves), shrinking the mostly empty hash
+** parts of the live tables it sweeps, then releases the recycled blocks
+** and shrinks the string table if it is mostly empty.
+*/
+static void shrinkstate (lua_State *L, void *ud) {
+  global_State *g = G(L);
+  l_mem work = *cast(l_mem *, ud);
+  if (g->gcrunning) {
+    g->gckind = KGC_EMERGENCY;
+    g->gcshrink = 1;
+    do {
+      work -= singlestep(L);
+    } while (work > 0 && g->gcstate != GCSpause);
+    g->gcshrink = 0;
+    g->gckind = KGC_NORMAL;
+    if (g->gcstate == GCSpause)
+      setpause(g);
+  }
+  luaC_freerecycled(L);
+  checkSizes(L, g);
+}
+
+
+int luaC_shrink (lua_State *L, l_mem work) {
+  global_State *g = G(L);
+  int status;
+  lua_assert(g->gckind == KGC_NORMAL);
+  status = luaD_rawrunprotected(L, shrinkstate, &work);
+  g->gcshrink = 0;
+  g->gckind = KGC_NORMAL;
+  return status;
+}
+
+
 /*
 ** Performs a full GC cycle; if 'isemergency', set a flag to avoid
 ** some operations which could change the interpreter state in some
@@ -1172,6 +1339,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   g->gckind = KGC_NORMAL;
+  luaC_freerecycled(L);  /* a full collection also drains recycled blocks */
   setpause(g);
 }
 
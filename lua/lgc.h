@@ -142,6 +142,10 @@ LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
+LUAI_FUNC void *luaC_newblock (lua_State *L, size_t sz, int l);
+LUAI_FUNC void luaC_freeblock (lua_State *L, void *b, size_t sz, int l);
+LUAI_FUNC void luaC_freerecycled (lua_State *L);
+LUAI_FUNC int luaC_shrink (lua_State *L, l_mem work);
 
 
 #endif
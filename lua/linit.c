@@ -54,6 +54,11 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_UTF8LIBNAME, luaopen_utf8},
   {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {LUA_INTMAPLIBNAME, luaopen_intmap},
+  {LUA_LRULIBNAME, luaopen_lru},
+  {LUA_LPMLIBNAME, luaopen_lpm},
+  {LUA_BITSETLIBNAME, luaopen_bitset},
 #if defined(LUA_COMPAT_BITLIB)
   {LUA_BITLIBNAME, luaopen_bit32},
 #endif
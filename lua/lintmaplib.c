@@ -0,0 +1,389 @@
+/*
+** Library for integer-keyed maps
+** See Copyright Notice in lua.h
+*/
+
+#define lintmaplib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <string.h>
+#endif /* _KERNEL */
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define INTMAPHANDLE	"intmap"
+
+
+/* states of a slot */
+#define SEMPTY		0
+#define SFULL		1
+#define SDELETED	2  /* removed entry; still holds its key for 'next' */
+
+
+typedef struct Slot {
+  lua_Integer key;
+  lua_Integer value;
+} Slot;
+
+
+/*
+** A map is a fixed block of 'size' slots, probed linearly, followed by
+** one state byte per slot. Removed entries leave their slots deleted
+** (so that chains through them still work and a traversal can go on
+** from a removed key), until an insertion finds too few empty slots
+** and rebuilds the map. There is always at least one empty slot, so
+** every probe ends.
+*/
+typedef struct IntMap {
+  size_t size;  /* number of slots */
+  size_t capacity;  /* maximum number of entries */
+  size_t count;  /* number of entries */
+  size_t ndeleted;  /* number of deleted slots */
+  lua_Unsigned seed;
+  unsigned char *state;  /* state of each slot (after the slots) */
+  Slot slot[];
+} IntMap;
+
+
+/* maximum number of full plus deleted slots */
+#define maxused(m)	((m)->size - (m)->size / 8 - 1)
+
+/* slots are indexed by the upper 32 bits of a 64-bit hash */
+#define MAXSLOTS	((size_t)0xFFFFFFFF)
+
+#define HASHMUL		((lua_Unsigned)0x9E3779B97F4A7C15)
+
+#define NOSLOT		(~(size_t)0)
+
+
+/*
+** all functions of the library have the metatable of maps as their
+** first upvalue (see 'checkarray' in larraylib.c)
+*/
+static IntMap *checkmap (lua_State *L, int arg) {
+  void *p = lua_touserdata(L, arg);
+  if (p != NULL && lua_getmetatable(L, arg)) {
+    int ok = lua_rawequal(L, -1, lua_upvalueindex(1));
+    lua_pop(L, 1);
+    if (ok)
+      return (IntMap *)p;
+  }
+  luaL_checkudata(L, arg, INTMAPHANDLE);  /* raise the error */
+  return NULL;  /* to avoid warnings */
+}
+
+
+/*
+** first slot probed for key 'k': a multiplicative hash of the key (mixed
+** with a per-map seed), scaled to the number of slots
+*/
+static size_t mainslot (IntMap *m, lua_Integer k) {
+  lua_Unsigned h = ((lua_Unsigned)k ^ m->seed) * HASHMUL;
+  return (size_t)(((h >> 32) * m->size) >> 32);
+}
+
+
+#define nextslot(m,i)	((i) + 1 == (m)->size ? 0 : (i) + 1)
+
+
+/*
+** returns the slot holding key 'k' or NOSLOT; if 'deleted', a deleted
+** slot that still holds 'k' also counts (a live one comes first in its
+** chain, as insertions reuse the first deleted slot they pass)
+*/
+static size_t findslot (IntMap *m, lua_Integer k, int deleted) {
+  size_t i = mainslot(m, k);
+  for (;;) {
+    int s = m->state[i];
+    if (s == SEMPTY)
+      return NOSLOT;
+    else if (m->slot[i].key == k && (s == SFULL || deleted))
+      return i;
+    i = nextslot(m, i);
+  }
+}
+
+
+/*
+** returns the first free slot in the chain of key 'k', which must not
+** be in the map
+*/
+static size_t freeslot (IntMap *m, lua_Integer k) {
+  size_t i = mainslot(m, k);
+  while (m->state[i] == SFULL)
+    i = nextslot(m, i);
+  return i;
+}
+
+
+/*
+** inserts all entries again, freeing the deleted slots; their copy goes
+** to a temporary userdata, so a memory error leaves the map unchanged
+*/
+static void rebuild (lua_State *L, IntMap *m) {
+  Slot *old = (Slot *)lua_newuserdata(L, m->count * sizeof(Slot));
+  size_t i, n = 0;
+  for (i = 0; i < m->size; i++) {
+    if (m->state[i] == SFULL)
+      old[n++] = m->slot[i];
+  }
+  memset(m->state, SEMPTY, m->size);
+  for (i = 0; i < n; i++) {
+    size_t j = freeslot(m, old[i].key);
+    m->slot[j] = old[i];
+    m->state[j] = SFULL;
+  }
+  m->ndeleted = 0;
+  lua_pop(L, 1);
+}
+
+
+/*
+** sets 'm[k] = v'; returns 0 if 'k' is a new key and the map is full
+*/
+static int mapset (lua_State *L, IntMap *m, lua_Integer k, lua_Integer v) {
+  size_t i = mainslot(m, k);
+  size_t del = NOSLOT;  /* first deleted slot in the chain */
+  for (;;) {
+    int s = m->state[i];
+    if (s == SEMPTY)
+      break;
+    else if (s == SFULL) {
+      if (m->slot[i].key == k) {
+        m->slot[i].value = v;
+        return 1;
+      }
+    }
+    else if (del == NOSLOT)
+      del = i;
+    i = nextslot(m, i);
+  }
+  if (m->count == m->capacity)
+    return 0;
+  if (del != NOSLOT) {  /* reuse a deleted slot */
+    i = del;
+    m->ndeleted--;
+  }
+  else if (m->count + m->ndeleted + 1 > maxused(m)) {
+    rebuild(L, m);
+    i = freeslot(m, k);
+  }
+  m->slot[i].key = k;
+  m->slot[i].value = v;
+  m->state[i] = SFULL;
+  m->count++;
+  return 1;
+}
+
+
+static int mapdelete (IntMap *m, lua_Integer k) {
+  size_t i = findslot(m, k, 0);
+  if (i == NOSLOT)
+    return 0;
+  m->state[i] = SDELETED;
+  m->count--;
+  m->ndeleted++;
+  return 1;
+}
+
+
+static int mnew (lua_State *L) {
+  lua_Integer cap = luaL_checkinteger(L, 1);
+  size_t size, head = offsetof(IntMap, slot);
+  IntMap *m;
+  luaL_argcheck(L, 0 < cap && (lua_Unsigned)cap <= MAXSLOTS / 4 * 3, 1,
+                   "invalid capacity");
+  size = (size_t)cap + (size_t)cap / 3 + 1;  /* at most 3/4 full */
+  luaL_argcheck(L, size <= (~(size_t)0 - head) / (sizeof(Slot) + 1), 1,
+                   "invalid capacity");
+  m = (IntMap *)lua_newuserdata(L, head + size * (sizeof(Slot) + 1));
+  m->size = size;
+  m->capacity = (size_t)cap;
+  m->count = m->ndeleted = 0;
+  m->seed = (lua_Unsigned)(size_t)m * HASHMUL;  /* varies among maps */
+  m->state = (unsigned char *)&m->slot[size];
+  memset(m->state, SEMPTY, size);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+
+static int mget (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  size_t i = findslot(m, luaL_checkinteger(L, 2), 0);
+  if (i == NOSLOT)
+    lua_pushnil(L);
+  else
+    lua_pushinteger(L, m->slot[i].value);
+  return 1;
+}
+
+
+/*
+** m:set(k, v) returns whether it could set 'm[k]' (false if the map is
+** full)
+*/
+static int mset (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  lua_Integer k = luaL_checkinteger(L, 2);
+  lua_Integer v = luaL_checkinteger(L, 3);
+  lua_pushboolean(L, mapset(L, m, k, v));
+  return 1;
+}
+
+
+/*
+** m:delete(k) returns whether 'k' was in the map
+*/
+static int mdelete (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  lua_pushboolean(L, mapdelete(m, luaL_checkinteger(L, 2)));
+  return 1;
+}
+
+
+static int mcount (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkmap(L, 1)->count);
+  return 1;
+}
+
+
+static int mclear (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  memset(m->state, SEMPTY, m->size);
+  m->count = m->ndeleted = 0;
+  return 0;
+}
+
+
+/*
+** m:next(k) works as 'next' for tables: it returns the entry after key
+** 'k' (or the first one, if 'k' is nil), in slot order; entries may be
+** removed during a traversal, but not added
+*/
+static int mnext (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  size_t i = 0;
+  if (!lua_isnoneornil(L, 2)) {
+    i = findslot(m, luaL_checkinteger(L, 2), 1);
+    if (i == NOSLOT)
+      return luaL_error(L, "invalid key to 'next'");
+    i++;
+  }
+  for (; i < m->size; i++) {
+    if (m->state[i] == SFULL) {
+      lua_pushinteger(L, m->slot[i].key);
+      lua_pushinteger(L, m->slot[i].value);
+      return 2;
+    }
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+
+/*
+** m[k]: integer keys are entries; other keys are methods
+*/
+static int mindex (lua_State *L) {
+  if (lua_type(L, 2) == LUA_TNUMBER)
+    return mget(L);
+  checkmap(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, lua_upvalueindex(2));  /* methods[k] */
+  return 1;
+}
+
+
+/*
+** m[k] = v sets an entry (raising an error if the map is full);
+** m[k] = nil removes it
+*/
+static int mnewindex (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  lua_Integer k = luaL_checkinteger(L, 2);
+  if (lua_isnil(L, 3))
+    mapdelete(m, k);
+  else if (!mapset(L, m, k, luaL_checkinteger(L, 3)))
+    return luaL_error(L, "map is full");
+  return 0;
+}
+
+
+static int mpairs (lua_State *L) {
+  checkmap(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(2));  /* 'next' method */
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+
+static int mtostring (lua_State *L) {
+  IntMap *m = checkmap(L, 1);
+  lua_pushfstring(L, INTMAPHANDLE " (%p)", m);
+  return 1;
+}
+
+
+static const luaL_Reg meth[] = {
+  {"get", mget},
+  {"set", mset},
+  {"delete", mdelete},
+  {"count", mcount},
+  {"clear", mclear},
+  {"next", mnext},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg metameth[] = {
+  {"__newindex", mnewindex},
+  {"__len", mcount},
+  {"__tostring", mtostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg intmap_funcs[] = {
+  {"new", mnew},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, INTMAPHANDLE);  /* create metatable for maps */
+  lua_pushvalue(L, -1);
+  luaL_setfuncs(L, metameth, 1);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, meth, 1);
+  lua_pushvalue(L, -2);  /* metatable */
+  lua_getfield(L, -2, "next");
+  lua_pushcclosure(L, mpairs, 2);  /* __pairs sees the 'next' method */
+  lua_setfield(L, -3, "__pairs");
+  lua_pushvalue(L, -2);  /* metatable */
+  lua_insert(L, -2);  /* put it below the method table */
+  lua_pushcclosure(L, mindex, 2);  /* __index sees the methods */
+  lua_setfield(L, -2, "__index");
+}
+
+
+LUAMOD_API int luaopen_intmap (lua_State *L) {
+  createmeta(L);  /* leaves the metatable on the stack */
+  luaL_newlibtable(L, intmap_funcs);
+  lua_insert(L, -2);
+  luaL_setfuncs(L, intmap_funcs, 1);
+  return 1;
+}
+
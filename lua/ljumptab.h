@@ -0,0 +1,107 @@
+/*
+** $Id: ljumptab.h $
+** Jump Table for the Lua interpreter
+** See Copyright Notice in lua.h
+*/
+
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+#undef vmfuse
+
+#define vmdispatch(x)     goto *disptab[x];
+
+#define vmcase(l)     L_##l:
+
+/* each opcode ends with its own copy of the dispatch */
+#define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
+
+/*
+** a superinstruction goes on with its second instruction, whose opcode
+** is 'o', without a dispatch (unless a hook must see that instruction)
+*/
+#define vmfuse(o)	{ \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) { vmbreak; } \
+  i = *(ci->u.l.savedpc++); \
+  ra = RA(i); \
+  goto L_##o; }
+
+
+/*
+** the kernel's objtool must know this is a jump table (as the one of
+** the BPF interpreter)
+*/
+#if !defined(__annotate_jump_table)
+#define __annotate_jump_table
+#endif
+
+
+static const void *const disptab[NUM_OPCODES] __annotate_jump_table = {
+
+/* in the order of 'OpCode' (see lopcodes.h) */
+&&L_OP_MOVE,
+&&L_OP_LOADK,
+&&L_OP_LOADKX,
+&&L_OP_LOADBOOL,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_GETTABUP,
+&&L_OP_GETTABLE,
+&&L_OP_SETTABUP,
+&&L_OP_SETUPVAL,
+&&L_OP_SETTABLE,
+&&L_OP_NEWTABLE,
+&&L_OP_SELF,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_MUL,
+&&L_OP_MOD,
+#ifndef _KERNEL
+&&L_OP_POW,
+&&L_OP_DIV,
+#endif /* _KERNEL */
+&&L_OP_IDIV,
+&&L_OP_BAND,
+&&L_OP_BOR,
+&&L_OP_BXOR,
+&&L_OP_SHL,
+&&L_OP_SHR,
+&&L_OP_UNM,
+&&L_OP_BNOT,
+&&L_OP_NOT,
+&&L_OP_LEN,
+&&L_OP_CONCAT,
+&&L_OP_JMP,
+&&L_OP_EQ,
+&&L_OP_LT,
+&&L_OP_LE,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&L_OP_CALL,
+&&L_OP_TAILCALL,
+&&L_OP_RETURN,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORCALL,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_EXTRAARG,
+&&L_OP_GETFIELD,
+&&L_OP_GETI,
+&&L_OP_SETFIELD,
+&&L_OP_SETI,
+&&L_OP_ADDI,
+&&L_OP_SUBI,
+&&L_OP_EQI,
+&&L_OP_LTI,
+&&L_OP_LEI,
+&&L_OP_GTI,
+&&L_OP_GEI,
+&&L_OP_MOVE2,
+&&L_OP_LOADK2,
+&&L_OP_GETFIELD2
+
+};
@@ -0,0 +1,503 @@
+/*
+** Library for longest-prefix matching of IP addresses
+** See Copyright Notice in lua.h
+*/
+
+#define llpmlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#ifndef _KERNEL
+#include <string.h>
+#endif /* _KERNEL */
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** {==================================================================
+** Bitmaps of 64 bits
+** ===================================================================
+*/
+
+typedef lua_Unsigned Bitmap;
+
+#if !defined(l_popcount)	/* { */
+
+#if defined(_KERNEL)
+
+#include <linux/bitops.h>
+#define l_popcount(x)	((int)hweight64(x))
+#define l_highbit(x)	(fls64(x) - 1)
+
+#elif defined(__GNUC__)
+
+#define l_popcount(x)	__builtin_popcountll(x)
+#define l_highbit(x)	(63 - __builtin_clzll(x))
+
+#else
+
+static int l_popcount (Bitmap x) {
+  int n = 0;
+  for (; x != 0; x &= x - 1) n++;
+  return n;
+}
+
+static int l_highbit (Bitmap x) {
+  int n = 0;
+  while (x >>= 1) n++;
+  return n;
+}
+
+#endif
+
+#endif			/* } */
+/* }================================================================== */
+
+
+#define LPMHANDLE	"lpm"
+
+
+/* number of address bits consumed by each node */
+#define STRIDE		6
+
+/* maximum depth of a node (for IPv6) */
+#define MAXDEPTH	(128 / STRIDE + 1)
+
+#define bit(b)		((Bitmap)1 << (b))
+
+/* position of bit 'b' among the set bits of 'm' */
+#define rank(m,b)	l_popcount((m) & (bit(b) - 1))
+
+/* internal bit of a prefix of 'l' (< STRIDE) bits with value 'v' */
+#define internalbit(l,v)	((1u << (l)) - 1 + (v))
+
+
+/*
+** A node of a tree bitmap covers STRIDE bits of the address. Its
+** 'internal' bitmap has a bit for each prefix of 0 to STRIDE - 1 bits
+** within the node (ordered by length, then value) and 'result' holds
+** their values, in the same order. Its 'external' bitmap has a bit for
+** each of the 2^STRIDE values of its bits that have a child, and
+** 'child' holds them, in the same order. A lookup walks down the nodes
+** of the address, keeping the longest internal prefix matched so far.
+*/
+typedef struct TNode {
+  Bitmap internal;
+  Bitmap external;
+  struct TNode *child;
+  int *result;  /* references into the user value of the trie */
+} TNode;
+
+
+typedef struct LPM {
+  TNode root[2];  /* for IPv4 and IPv6 */
+  lua_Integer count;  /* number of prefixes */
+  lua_Alloc allocf;
+  void *ud;
+} LPM;
+
+
+static LPM *checklpm (lua_State *L, int arg) {
+  void *p = lua_touserdata(L, arg);
+  if (p != NULL && lua_getmetatable(L, arg)) {
+    int ok = lua_rawequal(L, -1, lua_upvalueindex(1));
+    lua_pop(L, 1);
+    if (ok)
+      return (LPM *)p;
+  }
+  luaL_checkudata(L, arg, LPMHANDLE);  /* raise the error */
+  return NULL;  /* to avoid warnings */
+}
+
+
+static const unsigned char *checkaddr (lua_State *L, int arg,
+                                       size_t *size) {
+  const char *a = luaL_checklstring(L, arg, size);
+  luaL_argcheck(L, *size == 4 || *size == 16, arg,
+                   "address must have 4 or 16 bytes");
+  return (const unsigned char *)a;
+}
+
+
+static int checklen (lua_State *L, int arg, size_t size) {
+  lua_Integer len = luaL_checkinteger(L, arg);
+  luaL_argcheck(L, 0 <= len && (size_t)len <= size * 8, arg,
+                   "invalid prefix length");
+  return (int)len;
+}
+
+
+/*
+** returns the 'n' (<= STRIDE) bits of address 'a' at bit offset 'o'
+** (bits past the address are 0)
+*/
+static unsigned int getbits (const unsigned char *a, size_t size,
+                             unsigned int o, int n) {
+  size_t i = o / 8;
+  unsigned int w = (unsigned int)a[i] << 8;
+  if (i + 1 < size)
+    w |= a[i + 1];
+  return (w >> (16 - o % 8 - n)) & ((1u << n) - 1);
+}
+
+
+/*
+** internal bits of all prefixes matching bits 'c' of a node
+*/
+static Bitmap matching (unsigned int c) {
+  Bitmap m = 0;
+  int l;
+  for (l = 0; l < STRIDE; l++)
+    m |= bit(internalbit(l, c >> (STRIDE - l)));
+  return m;
+}
+
+
+/*
+** inserts element 'k' of an array of 'n' elements of 'size' bytes
+** (growing it by one) and returns the new array, or NULL if there is
+** no memory (then 'a' is left untouched)
+*/
+static void *openslot (LPM *t, void *a, int n, int k, size_t size) {
+  char *na = (char *)t->allocf(t->ud, a, n * size, (n + 1) * size);
+  if (na != NULL)
+    memmove(na + (k + 1) * size, na + k * size, (n - k) * size);
+  return na;
+}
+
+
+/*
+** removes element 'k' of an array of 'n' elements of 'size' bytes,
+** copying the others to a new array, and returns that array after
+** freeing 'a'; returns 'a' itself, untouched, if there is no memory
+** for the copy
+*/
+static void *closeslot (LPM *t, void *a, int n, int k, size_t size) {
+  char *ca = (char *)a;
+  char *na = NULL;
+  if (n > 1) {
+    na = (char *)t->allocf(t->ud, NULL, 0, (n - 1) * size);
+    if (na == NULL)
+      return a;
+    memcpy(na, ca, k * size);
+    memcpy(na + k * size, ca + (k + 1) * size, (n - k - 1) * size);
+  }
+  t->allocf(t->ud, a, n * size, 0);
+  return na;
+}
+
+
+static void freenode (LPM *t, TNode *n) {
+  int i, nc = l_popcount(n->external);
+  for (i = 0; i < nc; i++)
+    freenode(t, &n->child[i]);
+  t->allocf(t->ud, n->child, nc * sizeof(TNode), 0);
+  t->allocf(t->ud, n->result, l_popcount(n->internal) * sizeof(int), 0);
+  memset(n, 0, sizeof(TNode));
+}
+
+
+/*
+** sets prefix 'a/len' to the value on the top of the stack, which is
+** popped and referenced from table 'idx', creating the nodes on its
+** way; returns the previous reference, or LUA_NOREF. The reference is
+** only taken once the nodes exist (nodes left empty by an error are
+** harmless), and it is released if the prefix cannot be added.
+*/
+static int insertprefix (lua_State *L, LPM *t, const unsigned char *a,
+                         size_t size, int len, int idx) {
+  TNode *n = &t->root[size == 16];
+  int o, k, nr, ref;
+  int *res;
+  unsigned int ib;
+  for (o = 0; len - o >= STRIDE; o += STRIDE) {
+    unsigned int c = getbits(a, size, o, STRIDE);
+    k = rank(n->external, c);
+    if (!(n->external & bit(c))) {  /* no child? */
+      TNode *ch = (TNode *)openslot(t, n->child, l_popcount(n->external),
+                                    k, sizeof(TNode));
+      if (ch == NULL)
+        luaL_error(L, "not enough memory");
+      memset(&ch[k], 0, sizeof(TNode));
+      n->child = ch;
+      n->external |= bit(c);
+    }
+    n = &n->child[k];
+  }
+  ib = internalbit(len - o, getbits(a, size, o, len - o));
+  k = rank(n->internal, ib);
+  if (n->internal & bit(ib)) {  /* prefix already present? */
+    int old = n->result[k];
+    n->result[k] = luaL_ref(L, idx);
+    return old;
+  }
+  ref = luaL_ref(L, idx);
+  nr = l_popcount(n->internal);
+  res = (int *)openslot(t, n->result, nr, k, sizeof(int));
+  if (res == NULL) {
+    luaL_unref(L, idx, ref);
+    luaL_error(L, "not enough memory");
+  }
+  n->result = res;
+  n->result[k] = ref;
+  n->internal |= bit(ib);
+  t->count++;
+  return LUA_NOREF;
+}
+
+
+/*
+** removes prefix 'a/len', and the nodes it leaves empty (those are kept
+** if there is no memory to shrink their parents); returns its
+** reference, or LUA_NOREF
+*/
+static int deleteprefix (lua_State *L, LPM *t, const unsigned char *a,
+                         size_t size, int len) {
+  TNode *path[MAXDEPTH];
+  unsigned int chunk[MAXDEPTH];
+  TNode *n = &t->root[size == 16];
+  int o, d = 0, k, ref;
+  int *res;
+  unsigned int ib;
+  for (o = 0; len - o >= STRIDE; o += STRIDE) {
+    unsigned int c = getbits(a, size, o, STRIDE);
+    if (!(n->external & bit(c)))
+      return LUA_NOREF;
+    path[d] = n;
+    chunk[d++] = c;
+    n = &n->child[rank(n->external, c)];
+  }
+  ib = internalbit(len - o, getbits(a, size, o, len - o));
+  if (!(n->internal & bit(ib)))
+    return LUA_NOREF;
+  k = rank(n->internal, ib);
+  ref = n->result[k];
+  res = (int *)closeslot(t, n->result, l_popcount(n->internal), k,
+                         sizeof(int));
+  if (res == n->result)
+    luaL_error(L, "not enough memory");  /* nothing was changed */
+  n->result = res;
+  n->internal &= ~bit(ib);
+  t->count--;
+  while (d > 0 && n->internal == 0 && n->external == 0) {  /* empty? */
+    TNode *p = path[--d];
+    TNode *ch;
+    k = rank(p->external, chunk[d]);
+    ch = (TNode *)closeslot(t, p->child, l_popcount(p->external), k,
+                            sizeof(TNode));
+    if (ch == p->child)
+      break;  /* no memory: keep the empty node */
+    p->child = ch;
+    p->external &= ~bit(chunk[d]);
+    n = p;
+  }
+  return ref;
+}
+
+
+/*
+** returns the reference of the longest prefix matching address 'a' (and
+** its length in 'len'), or LUA_NOREF
+*/
+static int lookupprefix (LPM *t, const unsigned char *a, size_t size,
+                         int *len) {
+  TNode *n = &t->root[size == 16];
+  int ref = LUA_NOREF;
+  int o;
+  for (o = 0; ; o += STRIDE) {
+    unsigned int c = getbits(a, size, o, STRIDE);
+    Bitmap m = n->internal & matching(c);
+    if (m != 0) {  /* some prefix in this node matches? */
+      int ib = l_highbit(m);  /* longest one */
+      int l = 0;
+      while ((2u << l) - 1 <= (unsigned int)ib) l++;
+      ref = n->result[rank(n->internal, ib)];
+      *len = o + l;
+    }
+    if (!(n->external & bit(c)))
+      return ref;
+    n = &n->child[rank(n->external, c)];
+  }
+}
+
+
+static int tnew (lua_State *L) {
+  LPM *t = (LPM *)lua_newuserdata(L, sizeof(LPM));
+  memset(t->root, 0, sizeof(t->root));
+  t->count = 0;
+  t->allocf = lua_getallocf(L, &t->ud);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_setmetatable(L, -2);
+  lua_newtable(L);  /* values */
+  lua_setuservalue(L, -2);
+  return 1;
+}
+
+
+/*
+** t:delete(addr, len) removes prefix 'addr/len' and returns its value
+*/
+static int tdelete (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  size_t size;
+  const unsigned char *a = checkaddr(L, 2, &size);
+  int len = checklen(L, 3, size);
+  int ref;
+  lua_settop(L, 3);
+  lua_getuservalue(L, 1);  /* at index 4 */
+  ref = deleteprefix(L, t, a, size, len);
+  if (ref == LUA_NOREF)
+    return 0;
+  lua_rawgeti(L, 4, ref);
+  luaL_unref(L, 4, ref);
+  return 1;
+}
+
+
+/*
+** t:insert(addr, len, v) sets the value of prefix 'addr/len' (the
+** first 'len' bits of the 4 or 16 bytes of 'addr') to 'v'; a nil 'v'
+** removes it
+*/
+static int tinsert (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  size_t size;
+  const unsigned char *a = checkaddr(L, 2, &size);
+  int len = checklen(L, 3, size);
+  int ref;
+  if (lua_isnoneornil(L, 4)) {
+    lua_settop(L, 3);
+    tdelete(L);
+    return 0;
+  }
+  lua_settop(L, 4);
+  lua_getuservalue(L, 1);  /* at index 5 */
+  lua_pushvalue(L, 4);
+  ref = insertprefix(L, t, a, size, len, 5);
+  luaL_unref(L, 5, ref);  /* previous value, if any */
+  return 0;
+}
+
+
+/*
+** t:load(s, size, v) inserts the prefixes packed in string 's', each
+** one as an address of 'size' (4 or 16) bytes followed by a byte with
+** its length (as string.pack("c4B") or string.pack("c16B") give), all
+** with value 'v'; returns their number
+*/
+static int tload (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  size_t l, i;
+  const unsigned char *s = (const unsigned char *)luaL_checklstring(L, 2, &l);
+  lua_Integer size = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, size == 4 || size == 16, 3, "size must be 4 or 16");
+  luaL_argcheck(L, l % (size + 1) == 0, 2, "truncated record");
+  luaL_checkany(L, 4);
+  for (i = 0; i < l; i += size + 1) {  /* check all before inserting any */
+    if (s[i + size] > size * 8)
+      return luaL_error(L, "invalid prefix length in record %d",
+                           (int)(i / (size + 1)) + 1);
+  }
+  lua_settop(L, 4);
+  lua_getuservalue(L, 1);  /* at index 5 */
+  for (i = 0; i < l; i += size + 1) {
+    int ref;
+    lua_pushvalue(L, 4);
+    ref = insertprefix(L, t, s + i, (size_t)size, s[i + size], 5);
+    luaL_unref(L, 5, ref);
+  }
+  lua_pushinteger(L, (lua_Integer)(l / (size + 1)));
+  return 1;
+}
+
+
+/*
+** t:lookup(addr) returns the value of the longest prefix that matches
+** address 'addr' (4 or 16 bytes) and the length of that prefix, or nil
+*/
+static int tlookup (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  size_t size;
+  const unsigned char *a = checkaddr(L, 2, &size);
+  int len;
+  int ref = lookupprefix(t, a, size, &len);
+  if (ref == LUA_NOREF)
+    return 0;
+  lua_getuservalue(L, 1);
+  lua_rawgeti(L, -1, ref);
+  lua_pushinteger(L, len);
+  return 2;
+}
+
+
+static int tcount (lua_State *L) {
+  lua_pushinteger(L, checklpm(L, 1)->count);
+  return 1;
+}
+
+
+static int tgc (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  freenode(t, &t->root[0]);
+  freenode(t, &t->root[1]);
+  t->count = 0;
+  return 0;
+}
+
+
+static int ttostring (lua_State *L) {
+  LPM *t = checklpm(L, 1);
+  lua_pushfstring(L, LPMHANDLE " (%p)", t);
+  return 1;
+}
+
+
+static const luaL_Reg meth[] = {
+  {"insert", tinsert},
+  {"delete", tdelete},
+  {"load", tload},
+  {"lookup", tlookup},
+  {"count", tcount},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg metameth[] = {
+  {"__len", tcount},
+  {"__gc", tgc},
+  {"__tostring", ttostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg lpm_funcs[] = {
+  {"new", tnew},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, LPMHANDLE);  /* create metatable for tries */
+  lua_pushvalue(L, -1);
+  luaL_setfuncs(L, metameth, 1);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, meth, 1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+}
+
+
+LUAMOD_API int luaopen_lpm (lua_State *L) {
+  createmeta(L);  /* leaves the metatable on the stack */
+  luaL_newlibtable(L, lpm_funcs);
+  lua_insert(L, -2);
+  luaL_setfuncs(L, lpm_funcs, 1);
+  return 1;
+}
+
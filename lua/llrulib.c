@@ -0,0 +1,515 @@
+/*
+** Library for bounded maps with LRU eviction and expiry
+** See Copyright Notice in lua.h
+*/
+
+#define llrulib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#ifndef _KERNEL
+#include <limits.h>
+#include <string.h>
+#endif /* _KERNEL */
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** {==================================================================
+** Monotonic clock, in milliseconds
+** ===================================================================
+*/
+#if !defined(l_msecs)	/* { */
+
+#if defined(_KERNEL)
+
+#include <linux/ktime.h>
+#define l_msecs()	((lua_Integer)ktime_to_ms(ktime_get()))
+
+#elif defined(LUA_USE_POSIX)
+
+#include <time.h>
+
+static lua_Integer l_msecs (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (lua_Integer)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+#else
+
+#include <time.h>
+#define l_msecs()	((lua_Integer)time(NULL) * 1000)
+
+#endif
+
+#endif			/* } */
+/* }================================================================== */
+
+
+#define LRUHANDLE	"lru"
+
+
+/* number of expired entries that each access may evict */
+#define EXPIRESTEPS	4
+
+/* initial number of entries (a power of 2) */
+#define MINENTRIES	16
+
+#define HASHMUL		((lua_Unsigned)0x9E3779B97F4A7C15)
+
+
+/*
+** A key is a string (anchored by the map, so 's' stays valid) or an
+** integer ('s' is NULL)
+*/
+typedef struct Key {
+  const char *s;
+  size_t len;
+  lua_Integer i;
+  unsigned int hash;
+} Key;
+
+
+/*
+** Entries are linked from the most to the least recently used; entry 0
+** is the head of that list and free entries are linked by 'next' from
+** 'free'. As every access refreshes the expiry of an entry, the least
+** recently used entry is also the first to expire.
+*/
+typedef struct Entry {
+  lua_Integer expiry;  /* in milliseconds; unused if the map has no TTL */
+  lua_Integer cost;
+  Key key;
+  int prev, next;
+} Entry;
+
+
+/*
+** Keys are found through 'slot', an open-addressing index (probed
+** linearly, with twice as many slots as entries) of entry numbers,
+** so that replacing keys does not churn a Lua table. The Lua side of
+** a map is its user value, a table with the key of entry 'i' at 2i - 1
+** and its value at 2i (so the collector traverses them), and with:
+*/
+#define IONEVICT	0	/* the eviction callback, if any */
+#define IENTRIES	(-1)	/* the userdata holding the entries */
+#define ISLOTS		(-2)	/* the userdata holding the slots */
+
+
+typedef struct LRU {
+  Entry *e;  /* entries (in the userdata at [IENTRIES]) */
+  int *slot;  /* entry of each slot, or 0 (in the userdata at [ISLOTS]) */
+  unsigned int mask;  /* number of slots - 1 */
+  unsigned int seed;
+  int size;  /* number of entries, including the head */
+  int free;  /* first free entry, or 0 */
+  lua_Integer count;  /* number of keys */
+  lua_Integer used;  /* sum of the costs of the keys */
+  lua_Integer limit;  /* maximum for 'used' */
+  lua_Integer ttl;  /* in milliseconds; 0 means no expiry */
+} LRU;
+
+
+/*
+** all functions of the library have the metatable of maps as their
+** first upvalue (see 'checkarray' in larraylib.c)
+*/
+static LRU *checklru (lua_State *L, int arg) {
+  void *p = lua_touserdata(L, arg);
+  if (p != NULL && lua_getmetatable(L, arg)) {
+    int ok = lua_rawequal(L, -1, lua_upvalueindex(1));
+    lua_pop(L, 1);
+    if (ok)
+      return (LRU *)p;
+  }
+  luaL_checkudata(L, arg, LRUHANDLE);  /* raise the error */
+  return NULL;  /* to avoid warnings */
+}
+
+
+static void checkkey (lua_State *L, LRU *m, int arg, Key *k) {
+  if (lua_type(L, arg) == LUA_TSTRING) {
+    size_t l;
+    unsigned int h;
+    k->s = lua_tolstring(L, arg, &k->len);
+    h = m->seed ^ (unsigned int)k->len;
+    for (l = k->len; l > 0; l--)
+      h ^= ((h << 5) + (h >> 2) + (unsigned char)k->s[l - 1]);
+    k->hash = h;
+  }
+  else {
+    int isnum;
+    k->i = lua_tointegerx(L, arg, &isnum);
+    luaL_argcheck(L, isnum, arg, "string or integer expected");
+    k->s = NULL;
+    k->hash = (unsigned int)((((lua_Unsigned)k->i ^ m->seed) * HASHMUL) >> 32);
+  }
+}
+
+
+static int samekey (const Key *a, const Key *b) {
+  if (a->hash != b->hash)
+    return 0;
+  else if (a->s == NULL || b->s == NULL)
+    return (a->s == b->s && a->i == b->i);
+  else
+    return (a->len == b->len &&
+            (a->s == b->s || memcmp(a->s, b->s, a->len) == 0));
+}
+
+
+/*
+** returns the slot of key 'k', or the empty slot ending its chain
+*/
+static unsigned int findslot (LRU *m, const Key *k) {
+  unsigned int j = k->hash & m->mask;
+  int i;
+  while ((i = m->slot[j]) != 0 && !samekey(&m->e[i].key, k))
+    j = (j + 1) & m->mask;
+  return j;
+}
+
+
+/*
+** empties slot 'j', moving back the following slots of its cluster
+** that would become unreachable
+*/
+static void freeslot (LRU *m, unsigned int j) {
+  unsigned int mask = m->mask;
+  unsigned int hole = j;
+  int i;
+  for (;;) {
+    unsigned int h;
+    j = (j + 1) & mask;
+    if ((i = m->slot[j]) == 0)
+      break;
+    h = m->e[i].key.hash & mask;
+    if (hole < j ? (h <= hole || h > j) : (h <= hole && h > j)) {
+      m->slot[hole] = i;  /* its chain goes through 'hole' */
+      hole = j;
+    }
+  }
+  m->slot[hole] = 0;
+}
+
+
+static void unlinkentry (Entry *e, int i) {
+  e[e[i].prev].next = e[i].next;
+  e[e[i].next].prev = e[i].prev;
+}
+
+
+static void linkentry (Entry *e, int i) {
+  e[i].prev = 0;
+  e[i].next = e[0].next;
+  e[e[0].next].prev = i;
+  e[0].next = i;
+}
+
+
+/*
+** removes entry 'i', leaving its key and its value on the stack; 'kv'
+** is the stack index of the user value of the map
+*/
+static void removeentry (lua_State *L, LRU *m, int kv, int i) {
+  Entry *e = m->e;
+  lua_rawgeti(L, kv, 2 * i - 1);  /* key */
+  lua_rawgeti(L, kv, 2 * i);  /* value */
+  freeslot(m, findslot(m, &e[i].key));
+  lua_pushnil(L);
+  lua_rawseti(L, kv, 2 * i - 1);
+  lua_pushnil(L);
+  lua_rawseti(L, kv, 2 * i);
+  unlinkentry(e, i);
+  e[i].next = m->free;
+  m->free = i;
+  m->count--;
+  m->used -= e[i].cost;
+}
+
+
+/*
+** removes entry 'i' and calls the eviction callback, if any, with its
+** key, its value and 'why'; the callback may change the map
+*/
+static void evict (lua_State *L, LRU *m, int kv, int i, const char *why) {
+  removeentry(L, m, kv, i);
+  if (lua_rawgeti(L, kv, IONEVICT) == LUA_TNIL)
+    lua_pop(L, 3);
+  else {
+    lua_insert(L, -3);  /* put callback below key and value */
+    lua_pushstring(L, why);
+    lua_call(L, 3, 0);
+  }
+}
+
+
+#define expired(m,i,now)	((m)->ttl != 0 && (m)->e[i].expiry <= (now))
+
+
+/*
+** evicts up to 'n' expired entries, from the least recently used;
+** returns how many it evicted
+*/
+static lua_Integer expire (lua_State *L, LRU *m, int kv, lua_Integer n,
+                           lua_Integer now) {
+  lua_Integer k = 0;
+  int i;
+  while (k < n && (i = m->e[0].prev) != 0 && expired(m, i, now)) {
+    evict(L, m, kv, i, "expired");
+    k++;
+  }
+  return k;
+}
+
+
+/*
+** sets 'size' entries, linking the new ones as free, and twice as many
+** slots, indexing the entries in use
+*/
+static void resize (lua_State *L, LRU *m, int kv, int size) {
+  Entry *e;
+  int *slot;
+  int i, old = m->size;
+  if (size > INT_MAX / 2 ||
+      (size_t)size > ~(size_t)0 / sizeof(Entry) ||
+      (size_t)size * 2 > ~(size_t)0 / sizeof(int))
+    luaL_error(L, "too many entries");
+  e = (Entry *)lua_newuserdata(L, (size_t)size * sizeof(Entry));
+  slot = (int *)lua_newuserdata(L, (size_t)size * 2 * sizeof(int));
+  lua_rawseti(L, kv, ISLOTS);  /* old blocks are collected */
+  lua_rawseti(L, kv, IENTRIES);
+  if (old == 0)
+    e[0].prev = e[0].next = 0;  /* empty list */
+  else
+    memcpy(e, m->e, (size_t)old * sizeof(Entry));
+  for (i = (old == 0) ? 1 : old; i < size; i++)
+    e[i].next = (i + 1 < size) ? i + 1 : 0;
+  m->free = (old == 0) ? 1 : old;
+  m->e = e;
+  m->size = size;
+  m->slot = slot;
+  m->mask = (unsigned int)size * 2 - 1;
+  memset(slot, 0, (size_t)size * 2 * sizeof(int));
+  for (i = e[0].next; i != 0; i = e[i].next)
+    slot[findslot(m, &e[i].key)] = i;
+}
+
+
+static int lnew (lua_State *L) {
+  lua_Integer limit = luaL_checkinteger(L, 1);
+  lua_Integer ttl = luaL_optinteger(L, 2, 0);
+  LRU *m;
+  luaL_argcheck(L, limit > 0, 1, "limit must be positive");
+  luaL_argcheck(L, ttl >= 0, 2, "negative TTL");
+  /* 'now + ttl' must not overflow */
+  luaL_argcheck(L, ttl <= LUA_MAXINTEGER / 2, 2, "TTL too large");
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+  lua_settop(L, 3);
+  m = (LRU *)lua_newuserdata(L, sizeof(LRU));
+  m->e = NULL;
+  m->slot = NULL;
+  m->size = m->free = 0;
+  m->seed = (unsigned int)((lua_Unsigned)(size_t)m * HASHMUL >> 32);
+  m->count = m->used = 0;
+  m->limit = limit;
+  m->ttl = ttl;
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_setmetatable(L, -2);
+  lua_newtable(L);  /* user value */
+  lua_pushvalue(L, 3);
+  lua_rawseti(L, -2, IONEVICT);
+  resize(L, m, lua_gettop(L), MINENTRIES);
+  lua_setuservalue(L, -2);
+  return 1;
+}
+
+
+/*
+** m:get(k) returns the value of 'k' (or nil, if 'k' is absent or has
+** expired) and makes it the most recently used key
+*/
+static int lget (lua_State *L) {
+  LRU *m = checklru(L, 1);
+  lua_Integer now = l_msecs();
+  Key k;
+  int i;
+  checkkey(L, m, 2, &k);
+  lua_settop(L, 2);
+  lua_getuservalue(L, 1);  /* at index 3 */
+  expire(L, m, 3, EXPIRESTEPS, now);
+  i = m->slot[findslot(m, &k)];
+  if (i == 0)
+    return 0;
+  else if (expired(m, i, now)) {
+    evict(L, m, 3, i, "expired");
+    return 0;
+  }
+  unlinkentry(m->e, i);
+  linkentry(m->e, i);
+  m->e[i].expiry = now + m->ttl;
+  lua_rawgeti(L, 3, 2 * i);
+  return 1;
+}
+
+
+/*
+** m:delete(k) removes 'k' (without calling the eviction callback) and
+** returns its value
+*/
+static int ldelete (lua_State *L) {
+  LRU *m = checklru(L, 1);
+  Key k;
+  int i;
+  checkkey(L, m, 2, &k);
+  lua_settop(L, 2);
+  lua_getuservalue(L, 1);  /* at index 3 */
+  i = m->slot[findslot(m, &k)];
+  if (i == 0)
+    return 0;
+  removeentry(L, m, 3, i);
+  return 1;
+}
+
+
+/*
+** m:set(k, v [, cost]) sets the value of 'k' to 'v' (removing 'k' if
+** 'v' is nil) and makes it the most recently used key; then it evicts
+** the least recently used keys until the sum of the costs (1 by
+** default) is within the limit of the map
+*/
+static int lset (lua_State *L) {
+  LRU *m = checklru(L, 1);
+  lua_Integer cost = luaL_optinteger(L, 4, 1);
+  lua_Integer now = l_msecs();
+  Key k;
+  unsigned int j;
+  int i;
+  checkkey(L, m, 2, &k);
+  if (lua_isnil(L, 3)) {
+    lua_settop(L, 2);
+    return ldelete(L);
+  }
+  luaL_argcheck(L, 0 <= cost && cost <= m->limit, 4, "cost out of range");
+  lua_settop(L, 4);
+  lua_getuservalue(L, 1);  /* at index 5 */
+  expire(L, m, 5, EXPIRESTEPS, now);
+  j = findslot(m, &k);
+  if ((i = m->slot[j]) != 0) {  /* existing key? */
+    lua_pushvalue(L, 3);
+    lua_rawseti(L, 5, 2 * i);
+    unlinkentry(m->e, i);
+    m->used += cost - m->e[i].cost;
+  }
+  else {
+    if (m->free == 0) {
+      resize(L, m, 5, m->size * 2);
+      j = findslot(m, &k);
+    }
+    i = m->free;
+    if (k.s == NULL)
+      lua_pushinteger(L, k.i);  /* keep the key as an integer */
+    else
+      lua_pushvalue(L, 2);
+    lua_rawseti(L, 5, 2 * i - 1);  /* anchors the key */
+    lua_pushvalue(L, 3);
+    lua_rawseti(L, 5, 2 * i);
+    m->free = m->e[i].next;  /* nothing else can fail: take the entry */
+    m->e[i].key = k;
+    m->slot[j] = i;
+    m->count++;
+    m->used += cost;
+  }
+  m->e[i].cost = cost;
+  m->e[i].expiry = now + m->ttl;
+  linkentry(m->e, i);
+  while (m->used > m->limit)  /* 'i' itself fits in the limit */
+    evict(L, m, 5, m->e[0].prev, "evicted");
+  return 0;
+}
+
+
+/*
+** m:expire([n]) evicts up to 'n' (by default, all) expired keys and
+** returns how many it evicted
+*/
+static int lexpire (lua_State *L) {
+  LRU *m = checklru(L, 1);
+  lua_Integer n = luaL_optinteger(L, 2, LUA_MAXINTEGER);
+  lua_settop(L, 2);
+  lua_getuservalue(L, 1);  /* at index 3 */
+  lua_pushinteger(L, expire(L, m, 3, n, l_msecs()));
+  return 1;
+}
+
+
+static int lcount (lua_State *L) {
+  lua_pushinteger(L, checklru(L, 1)->count);
+  return 1;
+}
+
+
+static int lused (lua_State *L) {
+  lua_pushinteger(L, checklru(L, 1)->used);
+  return 1;
+}
+
+
+static int ltostring (lua_State *L) {
+  LRU *m = checklru(L, 1);
+  lua_pushfstring(L, LRUHANDLE " (%p)", m);
+  return 1;
+}
+
+
+static const luaL_Reg meth[] = {
+  {"get", lget},
+  {"set", lset},
+  {"delete", ldelete},
+  {"expire", lexpire},
+  {"count", lcount},
+  {"used", lused},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg metameth[] = {
+  {"__len", lcount},
+  {"__tostring", ltostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg lru_funcs[] = {
+  {"new", lnew},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, LRUHANDLE);  /* create metatable for maps */
+  lua_pushvalue(L, -1);
+  luaL_setfuncs(L, metameth, 1);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, meth);  /* create method table */
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, meth, 1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+}
+
+
+LUAMOD_API int luaopen_lru (lua_State *L) {
+  createmeta(L);  /* leaves the metatable on the stack */
+  luaL_newlibtable(L, lru_funcs);
+  lua_insert(L, -2);
+  luaL_setfuncs(L, lru_funcs, 1);
+  return 1;
+}
+
@@ -315,7 +315,7 @@ typedef TValue *StkId;  /* index to stack elements */
 typedef struct TString {
   CommonHeader;
   lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
-  lu_byte shrlen;  /* length for short strings */
+  lu_byte shrlen;  /* length for short strings; EXTSTR for external ones */
   unsigned int hash;
   union {
     size_t lnglen;  /* length for long strings */
@@ -333,12 +333,29 @@ typedef union UTString {
 } UTString;
 
 
+/*
+** Long strings whose bytes live in memory owned by someone else follow
+** their header with this structure; 'falloc' is called to release
+** 'contents' when the string is collected.
+*/
+typedef struct ExtString {
+  const char *contents;
+  lua_Alloc falloc;
+  void *ud;
+} ExtString;
+
+#define EXTSTR		255  /* 'shrlen' of external strings */
+#define isextstr(ts)	((ts)->shrlen == EXTSTR)
+#define extstr(ts)	cast(ExtString *, cast(char *, (ts)) + sizeof(UTString))
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  check_exp(sizeof((ts)->extra), isextstr(ts) ? \
+    cast(char *, extstr(ts)->contents) : cast(char *, (ts)) + sizeof(UTString))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -413,6 +430,18 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Inline cache of a constant key (see 'luaV_execute'): the value of the
+** key was found at 'slot' of the table whose layout was 'layout'
+*/
+typedef struct KCache {
+  lua_Unsigned layout;  /* layout of the table (0 if none) */
+  const TValue *slot;  /* value of the key in that table */
+  lua_Unsigned mtlayout;  /* (OP_SELF) layout of the object's metatable */
+  const TValue *index;  /* (OP_SELF) its field '__index' */
+} KCache;
+
+
 /*
 ** Function Prototypes
 */
@@ -436,6 +465,7 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  KCache *kcache;  /* inline caches of the constants (one for each in 'k') */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -510,10 +540,22 @@ typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
+  lu_byte lsizeold;  /* log2 of size of 'oldnode' array */
+  lu_byte ntraversals;  /* traversals that may be going on (see 'luaH_trim') */
+  lu_byte keepsize;  /* hash part was sized on purpose (see 'luaH_trim') */
   unsigned int sizearray;  /* size of 'array' array */
+  unsigned int lastnext;  /* traversal index of the last key from 'next' */
   TValue *array;  /* array part */
   Node *node;
+#if defined(LUAI_SWISSTABLE)
+  unsigned int nempty;  /* empty nodes that can still be taken */
+#else
   Node *lastfree;  /* any free position is before this position */
+#endif
+  Node *oldnode;  /* previous hash part while it is being migrated */
+  unsigned int moved;  /* number of nodes of 'oldnode' already migrated */
+  unsigned int border;  /* last border found by 'luaH_getn' */
+  lua_Unsigned layout;  /* changes whenever its nodes may move */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
@@ -69,6 +69,20 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "GETFIELD",
+  "GETI",
+  "SETFIELD",
+  "SETI",
+  "ADDI",
+  "SUBI",
+  "EQI",
+  "LTI",
+  "LEI",
+  "GTI",
+  "GEI",
+  "MOVE2",
+  "LOADK2",
+  "GETFIELD2",
   NULL
 };
 
@@ -126,5 +140,19 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_GETFIELD */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_GETI */
+ ,opmode(0, 0, OpArgU, OpArgK, iABC)		/* OP_SETFIELD */
+ ,opmode(0, 0, OpArgU, OpArgK, iABC)		/* OP_SETI */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_ADDI */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_SUBI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_EQI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LEI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GEI */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE2 */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADK2 */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_GETFIELD2 */
 };
 
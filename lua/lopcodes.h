@@ -112,6 +112,14 @@ enum OpMode {iABC, iABx, iAsBx, iAx};  /* basic instruction format */
 #define GETARG_sBx(i)	(GETARG_Bx(i)-MAXARG_sBx)
 #define SETARG_sBx(i,b)	SETARG_Bx((i),cast(unsigned int, (b)+MAXARG_sBx))
 
+/* signed immediates in argument C ('sC') are also represented in excess K */
+#define MAXARG_sC	(MAXARG_C>>1)
+#define GETARG_sC(i)	(GETARG_C(i)-MAXARG_sC)
+#define int2sC(i)	(cast_int(i)+MAXARG_sC)
+
+/* test whether integer 'i' fits in a 'sC' argument */
+#define fitsC(i)	(l_castS2U(i) + MAXARG_sC <= cast(lua_Unsigned, MAXARG_C))
+
 
 #define CREATE_ABC(o,a,b,c)	((cast(Instruction, o)<<POS_OP) \
 			| (cast(Instruction, a)<<POS_A) \
@@ -232,11 +240,33 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* specialized forms of the opcodes above (emitted by the code generator) */
+
+OP_GETFIELD,/*	A B C	R(A) := R(B)[Kst(C)]				*/
+OP_GETI,/*	A B C	R(A) := R(B)[C]					*/
+OP_SETFIELD,/*	A B C	R(A)[Kst(B)] := RK(C)				*/
+OP_SETI,/*	A B C	R(A)[B] := RK(C)				*/
+
+OP_ADDI,/*	A B sC	R(A) := R(B) + sC				*/
+OP_SUBI,/*	A B sC	R(A) := R(B) - sC				*/
+
+OP_EQI,/*	A B sC	if ((R(B) == sC) ~= A) then pc++		*/
+OP_LTI,/*	A B sC	if ((R(B) <  sC) ~= A) then pc++		*/
+OP_LEI,/*	A B sC	if ((R(B) <= sC) ~= A) then pc++		*/
+OP_GTI,/*	A B sC	if ((R(B) >  sC) ~= A) then pc++		*/
+OP_GEI,/*	A B sC	if ((R(B) >= sC) ~= A) then pc++		*/
+
+/* superinstructions (made by 'luaK_finish' out of two instructions) */
+
+OP_MOVE2,/*	A B	R(A) := R(B); then the next OP_MOVE		*/
+OP_LOADK2,/*	A Bx	R(A) := Kst(Bx); then the next OP_LOADK		*/
+OP_GETFIELD2/*	A B C	R(A) := R(B)[Kst(C)]; then the next OP_GETFIELD	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GETFIELD2) + 1)
 
 
 
@@ -261,6 +291,18 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) In OP_GETFIELD and OP_SETFIELD, the constant is a short string; in
+  OP_GETI and OP_SETI, the index is a non-negative integer.
+
+  (*) The specialized opcodes are appended after OP_EXTRAARG, so that
+  the opcodes of the original set keep their values.
+
+  (*) A superinstruction is the first instruction of a pair with its
+  opcode replaced; the second one is left in place (jumps may still go
+  to it). Other than the interpreter, everything sees a superinstruction
+  as its first instruction, and the interpreter runs just that one when
+  hooks are on.
+
 ===========================================================================*/
 
 
@@ -123,11 +123,13 @@ CallInfo *luaE_extendCI (lua_State *L) {
 */
 void luaE_freeCI (lua_State *L) {
   CallInfo *ci = L->ci;
-  CallInfo *next = ci->next;
-  ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    luaM_free(L, ci);
+  CallInfo *next;
+  /* free entries after 'ci' beyond the reserved ones */
+  while (L->nci > L->nciresv && (next = ci->next) != NULL) {
+    ci->next = next->next;
+    if (next->next != NULL)
+      next->next->previous = ci;
+    luaM_free(L, next);
     L->nci--;
   }
 }
@@ -139,8 +141,9 @@ void luaE_freeCI (lua_State *L) {
 void luaE_shrinkCI (lua_State *L) {
   CallInfo *ci = L->ci;
   CallInfo *next2;  /* next's next */
-  /* while there are two nexts */
-  while (ci->next != NULL && (next2 = ci->next->next) != NULL) {
+  /* while there are two nexts and entries beyond the reserved ones */
+  while (L->nci > L->nciresv &&
+         ci->next != NULL && (next2 = ci->next->next) != NULL) {
     luaM_free(L, ci->next);  /* free next */
     L->nci--;
     ci->next = next2;  /* remove 'next' from the list */
@@ -150,6 +153,25 @@ void luaE_shrinkCI (lua_State *L) {
 }
 
 
+/*
+** make sure the 'ci' list has at least 'n' entries, appending the new
+** ones at its end
+*/
+void luaE_reserveCI (lua_State *L, int n) {
+  CallInfo *ci = L->ci;
+  while (ci->next != NULL)
+    ci = ci->next;
+  while (L->nci < n) {
+    CallInfo *next = luaM_new(L, CallInfo);
+    ci->next = next;
+    next->previous = ci;
+    next->next = NULL;
+    L->nci++;
+    ci = next;
+  }
+}
+
+
 static void stack_init (lua_State *L1, lua_State *L) {
   int i; CallInfo *ci;
   /* initialize stack array */
@@ -174,6 +196,7 @@ static void freestack (lua_State *L) {
   if (L->stack == NULL)
     return;  /* stack not completely built yet */
   L->ci = &L->base_ci;  /* free the entire 'ci' list */
+  L->nciresv = 0;
   luaE_freeCI(L);
   lua_assert(L->nci == 0);
   luaM_freearray(L, L->stack, L->stacksize);  /* free stack array */
@@ -238,6 +261,8 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->nny = 1;
   L->status = LUA_OK;
   L->errfunc = 0;
+  L->nciresv = 0;
+  L->stackresv = 0;
 }
 
 
@@ -247,6 +272,7 @@ static void close_state (lua_State *L) {
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
+  luaS_migrate(L, MAX_INT);  /* finish a pending string-table resize */
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -310,11 +336,15 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->frealloc = f;
   g->ud = ud;
   g->mainthread = L;
+  luaS_makekey();
   g->seed = makeseed(L);
+  g->lastlayout = 0;
   g->gcrunning = 0;  /* no GC while building state */
+  g->gcshrink = 0;
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.hash = g->strt.old = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
@@ -330,6 +360,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->rcymax = 0;
+  for (i=0; i < RCY_N; i++) {
+    g->rcylist[i] = NULL;
+    g->rcycount[i] = 0;
+  }
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
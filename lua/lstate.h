@@ -55,10 +55,29 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
 
 
+/*
+** Lists of recycled blocks: dead tables, upvalues, Lua closures with up
+** to MAXRCYUPVALS upvalues and short strings (one list for each size)
+** can be kept and reused by new objects of the same kind and size.
+*/
+#define MAXRCYUPVALS	4
+#define RCY_TABLE	0
+#define RCY_UPVAL	1
+#define RCY_LCL		2
+#define RCY_SHRSTR	(RCY_LCL + MAXRCYUPVALS + 1)
+#define RCY_N		(RCY_SHRSTR + LUAI_MAXSHORTLEN + 1)
+
+/* maximum number of blocks kept in each list */
+#define MAXRCY		255
+
+
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  TString **old;  /* previous vector while a resize is in progress */
+  int oldsize;
+  int moved;  /* buckets of 'old' already moved to 'hash' */
 } stringtable;
 
 
@@ -126,10 +145,12 @@ typedef struct global_State {
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
+  lua_Unsigned lastlayout;  /* last layout given to a table */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte gcshrink;  /* true if sweep should also trim live tables */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -151,6 +172,9 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  void *rcylist[RCY_N];  /* lists of recycled blocks */
+  lu_byte rcycount[RCY_N];  /* number of blocks in each list */
+  lu_byte rcymax;  /* maximum of blocks per list (0 disables recycling) */
 } global_State;
 
 
@@ -181,6 +205,8 @@ struct lua_State {
   unsigned short nCcalls;  /* number of nested C calls */
   l_signalT hookmask;
   lu_byte allowhook;
+  unsigned short nciresv;  /* 'ci' entries kept when shrinking the list */
+  int stackresv;  /* stack size kept when shrinking the stack */
 };
 
 
@@ -229,6 +255,7 @@ LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
+LUAI_FUNC void luaE_reserveCI (lua_State *L, int n);
 
 
 #endif
@@ -28,11 +28,23 @@
 
 
 /*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
+** a macro to fill, once, the secret key of string hashes; each state
+** mixes its own random seed into it.
 */
-#if !defined(LUAI_HASHLIMIT)
-#define LUAI_HASHLIMIT		5
+#if !defined(luai_makekey)
+#define luai_makekey(k)		((void) 0)
+#endif
+
+
+static unsigned int hashkey[2];
+
+
+/*
+** number of buckets moved by each new short string while the string
+** table is being resized
+*/
+#if !defined(STRMIGRATE)
+#define STRMIGRATE	4
 #endif
 
 
@@ -48,12 +60,76 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+void luaS_makekey (void) {
+  luai_makekey(hashkey);
+}
+
+
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define sipround(v0,v1,v2,v3) { \
+  v0 += v1; v1 = rotl32(v1, 5); v1 ^= v0; v0 = rotl32(v0, 16); \
+  v2 += v3; v3 = rotl32(v3, 8); v3 ^= v2; \
+  v0 += v3; v3 = rotl32(v3, 7); v3 ^= v0; \
+  v2 += v1; v1 = rotl32(v1, 13); v1 ^= v2; v2 = rotl32(v2, 16); }
+
+
+/*
+** HalfSipHash-1-3 keyed by 'hashkey' and 'seed', so the hashes of
+** strings that come from outside cannot be predicted. It reads 4 bytes
+** per round and covers every byte of long strings. Strings of up to 8
+** bytes (most names and keys) go in a single round, which is also the
+** first round of the finalization, so those of 4 to 8 bytes hash as
+** fast as with the former hash, which took one byte at a time; shorter
+** ones take a few nanoseconds more.
+*/
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
-  unsigned int h = seed ^ cast(unsigned int, l);
-  size_t step = (l >> LUAI_HASHLIMIT) + 1;
-  for (; l >= step; l -= step)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
-  return h;
+  unsigned int v0 = hashkey[0] ^ seed;
+  unsigned int v1 = hashkey[1];
+  unsigned int v2 = v0 ^ 0x6c796765;
+  unsigned int v3 = v1 ^ 0x74656462;
+  unsigned int b = cast(unsigned int, l) << 24;
+  unsigned int m;
+  if (l <= 8) {  /* short string? */
+    unsigned int e;  /* the other bytes, with the length */
+    if (l >= 4) {  /* first and last 4 bytes (they may overlap) */
+      memcpy(&m, str, sizeof(m));
+      memcpy(&e, str + l - 4, sizeof(e));
+    }
+    else {  /* first, middle and last bytes (they may be the same) */
+      m = 0;
+      e = (l == 0) ? 0 : cast(unsigned int, cast_byte(str[0])) << 16 |
+                         cast(unsigned int, cast_byte(str[l >> 1])) << 8 |
+                         cast_byte(str[l - 1]);
+    }
+    v3 ^= m;
+    v1 ^= e ^ b;
+    v2 ^= 0xff;
+    sipround(v0, v1, v2, v3);
+    v0 ^= m;
+    sipround(v0, v1, v2, v3);
+    sipround(v0, v1, v2, v3);
+    return v1 ^ v3;
+  }
+  for (; l >= 4; l -= 4, str += 4) {
+    memcpy(&m, str, sizeof(m));
+    v3 ^= m;
+    sipround(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+  switch (l) {  /* remaining bytes */
+    case 3: b |= cast(unsigned int, cast_byte(str[2])) << 16;  /* FALLTHROUGH */
+    case 2: b |= cast(unsigned int, cast_byte(str[1])) << 8;  /* FALLTHROUGH */
+    case 1: b |= cast_byte(str[0]);
+  }
+  v3 ^= b;
+  sipround(v0, v1, v2, v3);
+  v0 ^= b;
+  v2 ^= 0xff;
+  sipround(v0, v1, v2, v3);
+  sipround(v0, v1, v2, v3);
+  sipround(v0, v1, v2, v3);
+  return v1 ^ v3;
 }
 
 
@@ -68,33 +144,64 @@ unsigned int luaS_hashlongstr (TString *ts) {
 
 
 /*
-** resizes the string table
+** moves at most 'n' buckets of the previous vector to the current one
+** and releases the previous vector once they are all moved. Sizes are
+** powers of 2, so old bucket 'i' feeds exactly the new buckets
+** 'i + k*oldsize'; these are initialized only when 'i' is moved, so a
+** resize never touches the whole new vector at once.
 */
-void luaS_resize (lua_State *L, int newsize) {
-  int i;
+void luaS_migrate (lua_State *L, int n) {
   stringtable *tb = &G(L)->strt;
-  if (newsize > tb->size) {  /* grow table if needed */
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = NULL;
-  }
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
+  if (tb->old == NULL) return;  /* no resize in progress */
+  for (; n > 0 && tb->moved < tb->oldsize; n--) {
+    int i;
+    TString *p = tb->old[tb->moved];
+    for (i = tb->moved++; i < tb->size; i += tb->oldsize)
+      tb->hash[i] = NULL;  /* initialize buckets fed by this one */
     while (p) {  /* for each node in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
       p->u.hnext = tb->hash[h];  /* chain it */
       tb->hash[h] = p;
       p = hnext;
     }
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+  if (tb->moved == tb->oldsize) {  /* all buckets moved? */
+    if (tb->old == tb->hash)  /* shrinking? */
+      luaM_reallocvector(L, tb->hash, tb->oldsize, tb->size, TString *);
+    else
+      luaM_freearray(L, tb->old, tb->oldsize);
+    tb->old = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
+}
+
+
+/*
+** resizes the string table; strings are moved to their new buckets a
+** few buckets at a time (see 'luaS_migrate'), so a resize does not
+** stall for a time proportional to the number of strings. A table
+** shrinks in place: its first 'newsize' buckets are already in their
+** final vector, and only the vanishing slice needs to be moved.
+*/
+void luaS_resize (lua_State *L, int newsize) {
+  stringtable *tb = &G(L)->strt;
+  TString **hash = tb->hash;
+  luaS_migrate(L, MAX_INT);  /* finish previous resize, if any */
+  if (newsize > tb->size) {  /* grow table? */
+    hash = luaM_newvector(L, newsize, TString *);
+    if (tb->size == 0) {  /* first vector? */
+      int i;
+      for (i = 0; i < newsize; i++)
+        hash[i] = NULL;
+    }
   }
+  tb->old = tb->hash;
+  tb->oldsize = tb->size;
+  tb->moved = (hash == tb->hash) ? newsize : 0;
+  tb->hash = hash;
   tb->size = newsize;
+  luaS_migrate(L, 0);  /* finish now if there is nothing to move */
 }
 
 
@@ -141,6 +248,7 @@ static TString *createstrobj (lua_State *L, size_t l, int tag, unsigned int h) {
   ts = gco2ts(o);
   ts->hash = h;
   ts->extra = 0;
+  ts->shrlen = 0;  /* not external */
   getstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
@@ -153,9 +261,24 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+/*
+** returns the list of short strings with hash 'h': while the table is
+** being resized, buckets of the previous vector not moved yet keep
+** their strings and also receive new ones
+*/
+static TString **strlist (stringtable *tb, unsigned int h) {
+  if (tb->old != NULL) {
+    int i = lmod(h, tb->oldsize);
+    if (i >= tb->moved)  /* not moved yet? */
+      return &tb->old[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = strlist(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -170,7 +293,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
+  TString **list = strlist(&g->strt, h);
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen &&
@@ -181,13 +304,14 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
+  if (g->strt.old != NULL)  /* resizing? */
+    luaS_migrate(L, STRMIGRATE);
+  else if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2)
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
-  }
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
+  list = strlist(&g->strt, h);  /* recompute, as its bucket may have moved */
   ts->u.hnext = *list;
   *list = ts;
   g->strt.nuse++;
@@ -198,6 +322,55 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
 /*
 ** new string (with explicit length)
 */
+struct ExtS {
+  const char *str;
+  size_t l;
+  TString *ts;
+};
+
+
+static void newextstr (lua_State *L, void *ud) {
+  struct ExtS *e = cast(struct ExtS *, ud);
+  if (e->l <= LUAI_MAXSHORTLEN)  /* short strings must be internalized */
+    e->ts = internshrstr(L, e->str, e->l);
+  else
+    e->ts = gco2ts(luaC_newobj(L, LUA_TLNGSTR, sizeextstr));
+}
+
+
+/*
+** Creates a string with the 'l' bytes at 'str' (followed by a '\0')
+** without copying them, unless it is short. 'falloc' (if not NULL) is
+** called as 'falloc(ud, str, l + 1, 0)' once the string no longer needs
+** 'str', which is right away if it was copied or could not be created.
+*/
+TString *luaS_newextstr (lua_State *L, const char *str, size_t l,
+                         lua_Alloc falloc, void *ud) {
+  struct ExtS e;
+  int status;
+  e.str = str;
+  e.l = l;
+  status = luaD_rawrunprotected(L, newextstr, &e);
+  if (status != LUA_OK || l <= LUAI_MAXSHORTLEN) {  /* 'str' not kept? */
+    if (falloc != NULL)
+      (*falloc)(ud, cast(void *, str), l + 1, 0);
+    if (status != LUA_OK)
+      luaD_throw(L, status);
+  }
+  else {
+    TString *ts = e.ts;
+    ts->hash = G(L)->seed;
+    ts->extra = 0;
+    ts->shrlen = EXTSTR;
+    ts->u.lnglen = l;
+    extstr(ts)->contents = str;
+    extstr(ts)->falloc = falloc;
+    extstr(ts)->ud = ud;
+  }
+  return e.ts;
+}
+
+
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   if (l <= LUAI_MAXSHORTLEN)  /* short string? */
     return internshrstr(L, str, l);
@@ -26,6 +26,7 @@
 #ifndef _KERNEL
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 #endif /* _KERNEL */
 
 #include "lua.h"
@@ -74,8 +75,34 @@
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
+/*
+** Hash parts with at least 2^MINMIGRATEBITS nodes are resized
+** incrementally: the new hash part starts empty and each new key moves
+** TABMIGRATE nodes of the previous one into it (see 'migrate').
+*/
+#if !defined(MINMIGRATEBITS)
+#define MINMIGRATEBITS	10
+#endif
+
+#if !defined(TABMIGRATE)
+#define TABMIGRATE	8
+#endif
+
+
+/* 'ntraversals' stops counting (and keeps the table as it is) here */
+#define MAXTRAVERSALS	255
+
+
 #define dummynode		(&dummynode_)
 
+
+/*
+** gives 't' a layout no table had before, so that inline caches
+** pointing to its nodes (see 'luaV_execute') do not match it anymore.
+** It must be called whenever a node may change its key or its place.
+*/
+#define newlayout(L,t)	((t)->layout = ++G(L)->lastlayout)
+
 static const Node dummynode_ = {
   {NILCONSTANT},  /* value */
   {{NILCONSTANT, 0}}  /* key */
@@ -114,6 +141,30 @@ static int l_hashfloat (lua_Number n) {
 #endif /* _KERNEL */
 
 
+/*
+** returns the index for 'key' if 'key' is an appropriate key to live in
+** the array part of the table, 0 otherwise.
+*/
+static unsigned int arrayindex (const TValue *key) {
+  if (ttisinteger(key)) {
+    lua_Integer k = ivalue(key);
+    if (0 < k && (lua_Unsigned)k <= MAXASIZE)
+      return cast(unsigned int, k);  /* 'key' is an appropriate array index */
+  }
+  return 0;  /* 'key' did not match some condition */
+}
+
+
+/*
+** true if node key 'k' is 'key'; the key may be dead already, but it is
+** ok to use it in 'next'
+*/
+#define isnextkey(k,key)	(luaV_rawequalobj(k, key) || \
+	(ttisdeadkey(k) && iscollectable(key) && deadvalue(k) == gcvalue(key)))
+
+
+#if !defined(LUAI_SWISSTABLE)
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -144,57 +195,290 @@ static Node *mainposition (const Table *t, const TValue *key) {
 
 
 /*
-** returns the index for 'key' if 'key' is an appropriate key to live in
-** the array part of the table, 0 otherwise.
+** returns the node of the hash part of 't' holding 'key', or NULL
 */
-static unsigned int arrayindex (const TValue *key) {
-  if (ttisinteger(key)) {
-    lua_Integer k = ivalue(key);
-    if (0 < k && (lua_Unsigned)k <= MAXASIZE)
-      return cast(unsigned int, k);  /* 'key' is an appropriate array index */
+static Node *findnode (const Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    int nx;
+    if (luaV_rawequalobj(gkey(n), key))
+      return n;  /* that's it */
+    nx = gnext(n);
+    if (nx == 0)
+      return NULL;  /* not found */
+    n += nx;
   }
-  return 0;  /* 'key' did not match some condition */
+}
+
+
+/*
+** returns the index of 'key' in the hash part of 't', or -1
+*/
+static int nodeindex (const Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    int nx;
+    if (isnextkey(gkey(n), key))
+      return cast_int(n - gnode(t, 0));
+    nx = gnext(n);
+    if (nx == 0)
+      return -1;  /* not found */
+    n += nx;
+  }
+}
+
+#else
+
+/*
+** {=============================================================
+** Open-addressing hash part
+** The hash part is probed in groups of GROUPSIZE nodes. Each node has
+** a control byte, kept after the node vector, which is either CTRLEMPTY
+** (never used) or the top 7 bits of the hash of its key. A search reads
+** the control bytes of a whole group at once and only touches the nodes
+** whose byte matches; it ends at the first group with an empty node.
+** Nodes are never emptied again: one whose value is nil is reused by a
+** new key when no empty node can be taken. At least 1/8 of the nodes
+** stay empty, so that every search ends.
+** ==============================================================
+*/
+
+#define GROUPBITS	3
+#define GROUPSIZE	(1 << GROUPBITS)
+
+#define CTRLEMPTY	0x80
+
+/* control byte of a key with hash 'h' */
+#define ctrlbyte(h)	cast_byte((h) >> 25)
+
+/* control bytes of the hash part of 't' */
+#define gctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/*
+** the home node of a key is taken first, when possible, and looked at
+** before any control byte, so that most hits touch a single node; the
+** group holding it is the first one probed, and the others follow at
+** triangular offsets, which visits all of them
+*/
+#define homeindex(t,h)	lmod(h, sizenode(t))
+#define ngroups(t)	(sizenode(t) >> GROUPBITS)
+#define firstgroup(t,h)	(homeindex(t, h) >> GROUPBITS)
+#define nextgroup(t,g,s)	lmod((g) + (s), ngroups(t))
+
+
+typedef unsigned long long Group;
+
+#define ONES	((Group)0x0101010101010101ULL)
+#define HIGHS	(ONES << 7)
+
+/*
+** set the top bit of the bytes of group 'c' that may be equal to 'b'
+** (there can be false positives, but no false negatives), that are
+** empty, or that are taken
+*/
+#define matchbyte(c,b)	\
+	((((c) ^ (ONES * (b))) - ONES) & ~((c) ^ (ONES * (b))) & HIGHS)
+#define matchempty(c)	((c) & HIGHS)
+#define matchfull(c)	(~(c) & HIGHS)
+
+#if defined(__GNUC__)
+#define lowbit(m)	__builtin_ctzll(m)
+#else
+static int lowbit (Group m) {
+  int i = 0;
+  for (; (m & 1) == 0; m >>= 1) i++;
+  return i;
+}
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define bytepos(m)	(GROUPSIZE - 1 - (lowbit(m) >> 3))
+#else
+#define bytepos(m)	(lowbit(m) >> 3)
+#endif
+
+/* index of the node of group 'g' marked by the lowest bit set in 'm' */
+#define groupnode(g,m)	(((g) << GROUPBITS) + bytepos(m))
+
+
+static Group loadgroup (const Table *t, unsigned int g) {
+  Group c;
+  memcpy(&c, gctrl(t) + (g << GROUPBITS), sizeof(c));
+  return c;
+}
+
+
+/*
+** hash of a key; strings already have well mixed hashes, but numbers
+** and addresses are mixed, as probing uses both ends of the hash
+*/
+static unsigned int hashkey (const TValue *key) {
+  unsigned int h;
+  switch (ttype(key)) {
+    case LUA_TSHRSTR:
+      return tsvalue(key)->hash;
+    case LUA_TLNGSTR:
+      return luaS_hashlongstr(tsvalue(key));
+    case LUA_TNUMINT: {
+      lua_Unsigned u = l_castS2U(ivalue(key));
+      h = cast(unsigned int, u ^ (u >> (sizeof(u) * CHAR_BIT / 2)));
+      break;
+    }
+#ifndef _KERNEL
+    case LUA_TNUMFLT:
+      h = cast(unsigned int, l_hashfloat(fltvalue(key)));
+      break;
+#endif /* _KERNEL */
+    case LUA_TBOOLEAN:
+      h = cast(unsigned int, bvalue(key));
+      break;
+    case LUA_TLIGHTUSERDATA:
+      h = point2uint(pvalue(key));
+      break;
+    case LUA_TLCF:
+      h = point2uint(fvalue(key));
+      break;
+    default:
+      lua_assert(!ttisdeadkey(key));
+      h = point2uint(gcvalue(key));
+      break;
+  }
+  h ^= h >> 16;  /* murmur3 finalizer */
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/*
+** returns the node of the hash part of 't' holding 'key', or NULL
+*/
+static Node *findnode (const Table *t, const TValue *key) {
+  unsigned int h, g, s;
+  if (isdummy(t))
+    return NULL;
+  h = hashkey(key);
+  if (luaV_rawequalobj(gkey(gnode(t, homeindex(t, h))), key))
+    return gnode(t, homeindex(t, h));  /* at its home node */
+  for (g = firstgroup(t, h), s = 1; ; g = nextgroup(t, g, s++)) {
+    Group c = loadgroup(t, g);
+    Group m;
+    for (m = matchbyte(c, ctrlbyte(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, groupnode(g, m));
+      if (luaV_rawequalobj(gkey(n), key))
+        return n;  /* that's it */
+    }
+    if (matchempty(c))
+      return NULL;  /* not found */
+  }
+}
+
+
+/*
+** returns the index of 'key' in the hash part of 't', or -1. A key
+** removed and collected may have been inserted again in a node farther
+** along its probe sequence, so a dead node is only taken when there is
+** no live one.
+*/
+static int nodeindex (const Table *t, const TValue *key) {
+  unsigned int h, g, s;
+  int dead = -1;  /* a dead node holding 'key', if any */
+  if (isdummy(t))
+    return -1;
+  h = hashkey(key);
+  for (g = firstgroup(t, h), s = 1; ; g = nextgroup(t, g, s++)) {
+    Group c = loadgroup(t, g);
+    Group m;
+    for (m = matchbyte(c, ctrlbyte(h)); m != 0; m &= m - 1) {
+      int i = groupnode(g, m);
+      const TValue *k = gkey(gnode(t, i));
+      if (luaV_rawequalobj(k, key))
+        return i;
+      else if (dead < 0 && isnextkey(k, key))
+        dead = i;
+    }
+    if (matchempty(c))
+      return dead;
+  }
+}
+
+/* }============================================================= */
+
+#endif
+
+
+/*
+** fills 'o' with a view of the previous hash part of a table being
+** migrated, good enough to search it
+*/
+static const Table *oldpart (const Table *t, Table *o) {
+  o->node = t->oldnode;
+  o->lsizenode = t->lsizeold;
+  return o;
+}
+
+
+/*
+** true if 'key' is at index 'i' of a traversal of 't'
+*/
+static int isatindex (const Table *t, unsigned int i, const TValue *key) {
+  if (i == 0)
+    return 0;
+  else if (i <= t->sizearray)
+    return (ttisinteger(key) && ivalue(key) == cast(lua_Integer, i));
+  i -= t->sizearray + 1;
+  if (i < cast(unsigned int, sizenode(t)))
+    return isnextkey(gkey(gnode(t, i)), key);
+  i -= sizenode(t);
+  return (ismigrating(t) && i < cast(unsigned int, sizeold(t)) &&
+          isnextkey(gkey(&t->oldnode[i]), key));
 }
 
 
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then elements in the hash part, then
+** elements of the previous hash part not migrated yet. The beginning
+** of a traversal is signaled by 0. A traversal usually gives back the
+** key returned by the previous call, whose index was kept in 'lastnext',
+** so that key is not searched again (unless the table was resized or
+** another traversal came in between).
 */
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
+  if (isatindex(t, t->lastnext, key))
+    return t->lastnext;  /* continue from the previous call */
   i = arrayindex(key);
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
-    int nx;
-    Node *n = mainposition(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||
-            (ttisdeadkey(gkey(n)) && iscollectable(key) &&
-             deadvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return (i + 1) + t->sizearray;
-      }
-      nx = gnext(n);
-      if (nx == 0)
-        luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-      else n += nx;
+    int j = nodeindex(t, key);
+    if (j < 0 && ismigrating(t)) {  /* not in current hash part? */
+      Table o;
+      j = nodeindex(oldpart(t, &o), key);
+      if (j >= 0)
+        j += sizenode(t);  /* old elements are numbered after new ones */
     }
+    if (j < 0)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    /* hash elements are numbered after array ones */
+    return (j + 1) + t->sizearray;
   }
 }
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
   unsigned int i = findindex(L, t, key);  /* find original element */
+  if (i == 0 ? t->ntraversals < MAXTRAVERSALS : t->ntraversals == 0)
+    t->ntraversals++;  /* a traversal starts (or one not counted goes on) */
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
       setivalue(key, i + 1);
       setobj2s(L, key+1, &t->array[i]);
+      t->lastnext = i + 1;
       return 1;
     }
   }
@@ -202,9 +486,23 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      t->lastnext = (i + 1) + t->sizearray;
       return 1;
     }
   }
+  if (ismigrating(t)) {  /* then nodes not migrated yet */
+    for (i -= sizenode(t); cast_int(i) < sizeold(t); i++) {
+      Node *n = &t->oldnode[i];
+      if (!ttisnil(gval(n))) {  /* a non-nil value? */
+        setobj2s(L, key, gkey(n));
+        setobj2s(L, key+1, gval(n));
+        t->lastnext = (i + 1) + t->sizearray + sizenode(t);
+        return 1;
+      }
+    }
+  }
+  if (t->ntraversals < MAXTRAVERSALS)  /* not lost count? */
+    t->ntraversals--;  /* this traversal is over */
   return 0;  /* no more elements */
 }
 
@@ -215,6 +513,10 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
 ** ==============================================================
 */
 
+
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key);
+
+
 /*
 ** Compute the optimal size for the array part of table 't'. 'nums' is a
 ** "count array" where 'nums[i]' is the number of integers in the table
@@ -286,12 +588,13 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
 }
 
 
-static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
+static int numusenodes (Node *node, int size, unsigned int *nums,
+                                                unsigned int *pna) {
   int totaluse = 0;  /* total number of elements */
   int ause = 0;  /* elements added to 'nums' (can go to array part) */
-  int i = sizenode(t);
+  int i = size;
   while (i--) {
-    Node *n = &t->node[i];
+    Node *n = &node[i];
     if (!ttisnil(gval(n))) {
       ause += countint(gkey(n), nums);
       totaluse++;
@@ -302,6 +605,14 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 }
 
 
+static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
+  int totaluse = numusenodes(t->node, sizenode(t), nums, pna);
+  if (ismigrating(t))  /* count nodes not migrated yet, too */
+    totaluse += numusenodes(t->oldnode, sizeold(t), nums, pna);
+  return totaluse;
+}
+
+
 static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
   unsigned int i;
   luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
@@ -311,27 +622,93 @@ static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
 }
 
 
-static void setnodevector (lua_State *L, Table *t, unsigned int size) {
-  if (size == 0) {  /* no elements to hash part? */
+/*
+** empties all nodes of the (non dummy) hash part of 't'
+*/
+static void clearnodes (Table *t) {
+  int size = sizenode(t);
+  int i;
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilvalue(wgkey(n));
+    setnilvalue(gval(n));
+  }
+#if defined(LUAI_SWISSTABLE)
+  memset(gctrl(t), CTRLEMPTY, size);  /* all control bytes */
+  t->nempty = size - size / 8;
+#else
+  t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
+}
+
+
+/*
+** log2 of the number of nodes of a hash part for 'size' elements
+*/
+static int nodelsize (lua_State *L, unsigned int size) {
+#if defined(LUAI_SWISSTABLE)
+  int lsize = luaO_ceillog2(size + (size + 6) / 7);  /* keep 1/8 empty */
+  if (lsize < GROUPBITS)
+    lsize = GROUPBITS;
+#else
+  int lsize = luaO_ceillog2(size);
+#endif
+  if (lsize > MAXHBITS)
+    luaG_runerror(L, "table overflow");
+  return lsize;
+}
+
+
+/*
+** makes 'node' (with 2^lsize nodes, or NULL for 'dummynode') the empty
+** hash part of 't'
+*/
+static void setnodes (lua_State *L, Table *t, Node *node, int lsize) {
+  newlayout(L, t);
+  if (node == NULL) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
+#if defined(LUAI_SWISSTABLE)
+    t->nempty = 0;
+#else
     t->lastfree = NULL;  /* signal that it is using dummy node */
+#endif
   }
   else {
-    int i;
-    int lsize = luaO_ceillog2(size);
-    if (lsize > MAXHBITS)
-      luaG_runerror(L, "table overflow");
+    t->node = node;
+    t->lsizenode = cast_byte(lsize);
+    clearnodes(t);
+  }
+}
+
+
+static void setnodevector (lua_State *L, Table *t, unsigned int size) {
+  if (size == 0)
+    setnodes(L, t, NULL, 0);
+  else {
+    int lsize = nodelsize(L, size);
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
-    for (i = 0; i < (int)size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;
-      setnilvalue(wgkey(n));
-      setnilvalue(gval(n));
+#if defined(LUAI_SWISSTABLE)
+    if (cast(size_t, size) + 1 > MAX_SIZET / (sizeof(Node) + 1))
+      luaM_toobig(L);
+    setnodes(L, t, cast(Node *, luaM_malloc(L, sizenodevector(size))), lsize);
+#else
+    setnodes(L, t, luaM_newvector(L, size, Node), lsize);
+#endif
+  }
+}
+
+
+static void reinsert (lua_State *L, Table *t, Node *nold, int size) {
+  int j;
+  for (j = size - 1; j >= 0; j--) {
+    Node *old = nold + j;
+    if (!ttisnil(gval(old))) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
     }
-    t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */
   }
 }
 
@@ -339,14 +716,16 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
 void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
-  int j;
   unsigned int oldasize = t->sizearray;
   int oldhsize = allocsizenode(t);
   Node *nold = t->node;  /* save old hash ... */
+  Node *pold = t->oldnode;  /* ... and nodes still being migrated */
+  int poldsize = ismigrating(t) ? sizeold(t) : 0;
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
   setnodevector(L, t, nhsize);
+  t->oldnode = NULL;  /* migration (if any) is done here */
   if (nasize < oldasize) {  /* array part must shrink? */
     t->sizearray = nasize;
     /* re-insert elements from vanishing slice */
@@ -358,24 +737,67 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
   }
   /* re-insert elements from hash part */
-  for (j = oldhsize - 1; j >= 0; j--) {
-    Node *old = nold + j;
-    if (!ttisnil(gval(old))) {
-      /* doesn't need barrier/invalidate cache, as entry was
-         already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
-    }
-  }
+  reinsert(L, t, nold, oldhsize);
   if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    luaM_freemem(L, nold, sizenodevector(oldhsize)); /* free old hash */
+  if (pold != NULL) {  /* was migrating? */
+    reinsert(L, t, pold, poldsize);  /* (migrated nodes are empty) */
+    luaM_freemem(L, pold, sizenodevector(poldsize));
+  }
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   int nsize = allocsizenode(t);
+  if (ismigrating(t))  /* make room for nodes not migrated yet */
+    nsize += sizeold(t) - t->moved;
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** starts an incremental resize of the hash part of 't': the current
+** hash part becomes the previous one, and its nodes are moved to a new
+** one with room for 'nhsize' elements plus the keys that may be added
+** until the migration is done
+*/
+static void startmigration (lua_State *L, Table *t, unsigned int nhsize) {
+  Node *nold = t->node;
+  lu_byte lsize = t->lsizenode;
+  setnodevector(L, t, nhsize + sizenode(t) / TABMIGRATE);
+  t->oldnode = nold;
+  t->lsizeold = lsize;
+  t->moved = 0;
+}
+
+
+/*
+** moves up to 'n' nodes of the previous hash part to the current one.
+** A passed node keeps its place in its chain, but lookups ignore it
+** (it is below 'moved') and the collector no longer visits it, so its
+** key is marked dead (even if its value was already nil) so that
+** nothing compares against an object the collector no longer sees.
+*/
+static void migrate (lua_State *L, Table *t, int n) {
+  for (; n > 0; n--) {
+    Node *old = &t->oldnode[t->moved];
+    if (!ttisnil(gval(old))) {
+      TValue *v = insertkey(L, t, gkey(old));
+      if (v == NULL)  /* no room left? */
+        return;  /* 'luaH_newkey' will rehash the whole table */
+      setobjt2t(L, v, gval(old));
+      setnilvalue(gval(old));
+    }
+    if (iscollectable(gkey(old)))
+      setdeadvalue(wgkey(old));
+    if (++t->moved == cast(unsigned int, sizeold(t))) {  /* done? */
+      luaM_freemem(L, t->oldnode, sizenodevector(sizeold(t)));
+      t->oldnode = NULL;
+      return;
+    }
+  }
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -386,6 +808,7 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   int i;
   int totaluse;
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
+  t->keepsize = 0;  /* the table outgrew any size it was given */
   na = numusearray(t, nums);  /* count keys in array part */
   totaluse = na;  /* all those keys are integer keys */
   totaluse += numusehash(t, nums, &na);  /* count keys in hash part */
@@ -394,8 +817,11 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   totaluse++;
   /* compute new size for array part */
   asize = computesizes(nums, &na);
-  /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, totaluse - na);
+  if (asize == t->sizearray && !ismigrating(t) &&
+      t->lsizenode >= MINMIGRATEBITS && !isdummy(t))  /* large hash part? */
+    startmigration(L, t, totaluse - na);  /* move its nodes incrementally */
+  else  /* resize the table to new computed sizes */
+    luaH_resize(L, t, asize, totaluse - na);
 }
 
 
@@ -412,19 +838,102 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->lastnext = 0;
+  t->ntraversals = t->keepsize = 0;
+  t->oldnode = NULL;
+  t->moved = 0;
+  t->lsizeold = 0;
+  t->border = 0;
   setnodevector(L, t, 0);
   return t;
 }
 
 
+/*
+** Shrink the hash part of 't' to fit its entries when at most 1/4 of
+** its nodes are in use (finishing a migration, if any). A removed
+** entry keeps its (maybe dead) key, and a traversal may still be going
+** through that key, so a table is left alone while 'ntraversals'
+** counts a traversal that may be going on: 'luaH_next' counts
+** traversals as they start and end, and a new key ends them all, as
+** they cannot go on after it (a traversal given up before its end
+** keeps the table as it is until then). Hash parts sized on purpose
+** ('keepsize') are kept too. The new hash part is allocated without
+** raising errors or collecting (the table is left as it is if there is
+** no memory), so this can be called while sweeping.
+*/
+void luaH_trim (lua_State *L, Table *t) {
+  global_State *g = G(L);
+  int size = allocsizenode(t);
+  int osize = ismigrating(t) ? sizeold(t) : 0;
+  unsigned int nums[MAXABITS + 1];
+  unsigned int na = 0;
+  int use, lsize = 0;
+  Node *nold = t->node;
+  Node *pold = t->oldnode;
+  Node *node = NULL;
+  if (size == 0 || t->ntraversals > 0 || t->keepsize)
+    return;
+  memset(nums, 0, sizeof(nums));
+  use = numusehash(t, nums, &na);
+  if (use > (size + osize) / 4)
+    return;  /* not worth it */
+  if (use > 0) {
+    size_t nsize;
+    lsize = nodelsize(L, use);
+    if (lsize >= t->lsizenode && osize == 0)
+      return;  /* would not shrink */
+    nsize = sizenodevector(twoto(lsize));
+    node = cast(Node *, (*g->frealloc)(g->ud, NULL, 0, nsize));
+    if (node == NULL)
+      return;  /* no memory: keep it */
+    g->GCdebt += nsize;
+  }
+  setnodes(L, t, node, lsize);
+  t->oldnode = NULL;  /* a migration (if any) is done here */
+  reinsert(L, t, nold, size);  /* fits: no allocation */
+  luaM_freemem(L, nold, sizenodevector(size));
+  if (pold != NULL) {
+    reinsert(L, t, pold, osize);  /* (migrated nodes are empty) */
+    luaM_freemem(L, pold, sizenodevector(osize));
+  }
+}
+
+
+/*
+** Remove all entries of 't', keeping its array and hash parts for the
+** entries to come (the previous hash part of a migration is released).
+*/
+void luaH_clear (lua_State *L, Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (ismigrating(t)) {
+    luaM_freemem(L, t->oldnode, sizenodevector(sizeold(t)));
+    t->oldnode = NULL;
+  }
+  if (!isdummy(t))
+    clearnodes(t);
+  newlayout(L, t);
+  t->lastnext = t->border = 0;
+  t->ntraversals = 0;  /* they cannot go on */
+  t->keepsize = 1;  /* for the entries to come */
+  invalidateTMcache(t);
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    luaM_freemem(L, t->node, sizenodevector(sizenode(t)));
+  if (ismigrating(t))
+    luaM_freemem(L, t->oldnode, sizenodevector(sizeold(t)));
   luaM_freearray(L, t->array, t->sizearray);
-  luaM_free(L, t);
+  luaC_freeblock(L, t, sizeof(Table), RCY_TABLE);
 }
 
 
+#if !defined(LUAI_SWISSTABLE)
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -443,34 +952,16 @@ static Node *getfreepos (Table *t) {
 ** position is free. If not, check whether colliding node is in its main
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** position), new key goes to an empty position. Returns NULL if there is
+** no empty position left.
 */
-TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp;
-#ifndef _KERNEL
-  TValue aux;
-#endif /* _KERNEL */
-  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-#ifndef _KERNEL
-  else if (ttisfloat(key)) {
-    lua_Integer k;
-    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
-      setivalue(&aux, k);
-      key = &aux;  /* insert it as an integer */
-    }
-    else if (luai_numisnan(fltvalue(key)))
-      luaG_runerror(L, "table index is NaN");
-  }
-#endif /* _KERNEL */
-  mp = mainposition(t, key);
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
     Node *f = getfreepos(t);  /* get a free place */
-    if (f == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      /* whatever called 'newkey' takes care of TM cache */
-      return luaH_set(L, t, key);  /* insert key into grown table */
-    }
+    if (f == NULL)  /* cannot find a free place? */
+      return NULL;
     lua_assert(!isdummy(t));
     othern = mainposition(t, gkey(mp));
     if (othern != mp) {  /* is colliding node out of its main position? */
@@ -500,6 +991,101 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   return gval(mp);
 }
 
+#else
+
+/*
+** inserts a new key into the hash part; it takes its home node if that
+** is free, else the first empty node of its probe sequence, or, once no
+** more nodes can be taken, a node whose value is nil. Returns NULL if
+** there is no such node.
+*/
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
+  Node *n;
+  unsigned int h, g, s, i;
+  if (isdummy(t))
+    return NULL;
+  h = hashkey(key);
+  i = homeindex(t, h);
+  n = gnode(t, i);
+  if (gctrl(t)[i] == CTRLEMPTY && t->nempty > 0)
+    t->nempty--;  /* take its home node */
+  else if (gctrl(t)[i] == CTRLEMPTY || !ttisnil(gval(n)))
+    n = NULL;  /* home node is not free; look along the probe sequence */
+  for (g = firstgroup(t, h), s = 1; n == NULL; g = nextgroup(t, g, s++)) {
+    Group c = loadgroup(t, g);
+    Group m = matchempty(c);
+    if (m != 0 && t->nempty > 0) {  /* can take an empty node? */
+      t->nempty--;
+      n = gnode(t, groupnode(g, m));
+    }
+    else {
+      if (t->nempty == 0) {  /* look for a node whose value was removed */
+        Group f;
+        for (f = matchfull(c); f != 0 && n == NULL; f &= f - 1) {
+          if (ttisnil(gval(gnode(t, groupnode(g, f)))))
+            n = gnode(t, groupnode(g, f));  /* reuse it */
+        }
+      }
+      if (n == NULL && m != 0)  /* end of probe sequence? */
+        return NULL;
+    }
+  }
+  gctrl(t)[n - gnode(t, 0)] = ctrlbyte(h);
+  setnodekey(L, &n->i_key, key);
+  luaC_barrierback(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+
+#endif
+
+
+TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+  TValue *v;
+#ifndef _KERNEL
+  TValue aux;
+#endif /* _KERNEL */
+  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
+#ifndef _KERNEL
+  else if (ttisfloat(key)) {
+    lua_Integer k;
+    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
+      setivalue(&aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+#endif /* _KERNEL */
+  newlayout(L, t);  /* nodes may be moved or reused */
+  t->ntraversals = 0;  /* a new key ends them (see 'luaH_trim') */
+  if (ismigrating(t))
+    migrate(L, t, TABMIGRATE);
+  v = insertkey(L, t, key);
+  if (v == NULL) {  /* no free place? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  return v;
+}
+
+
+/*
+** search function for the previous hash part of a table being migrated;
+** nodes already moved are not there anymore
+*/
+static const TValue *getold (const Table *t, const TValue *key) {
+  if (ismigrating(t)) {
+    Table o;
+    Node *n = findnode(oldpart(t, &o), key);
+    if (n != NULL && cast(unsigned int, n - t->oldnode) >= t->moved)
+      return gval(n);
+  }
+  return luaO_nilobject;
+}
+
 
 /*
 ** search function for integers
@@ -509,6 +1095,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
   else {
+#if !defined(LUAI_SWISSTABLE)
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -519,6 +1106,34 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
         n += nx;
       }
     }
+#else
+    if (!isdummy(t)) {
+      TValue k;
+      unsigned int h, g, s;
+      Node *n;
+      setivalue(&k, key);
+      h = hashkey(&k);
+      n = gnode(t, homeindex(t, h));
+      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+        return gval(n);  /* at its home node */
+      for (g = firstgroup(t, h), s = 1; ; g = nextgroup(t, g, s++)) {
+        Group c = loadgroup(t, g);
+        Group m;
+        for (m = matchbyte(c, ctrlbyte(h)); m != 0; m &= m - 1) {
+          n = gnode(t, groupnode(g, m));
+          if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+            return gval(n);  /* that's it */
+        }
+        if (matchempty(c))
+          break;  /* not found */
+      }
+    }
+#endif
+    if (ismigrating(t)) {
+      TValue k;
+      setivalue(&k, key);
+      return getold(t, &k);
+    }
     return luaO_nilobject;
   }
 }
@@ -528,6 +1143,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
+#if !defined(LUAI_SWISSTABLE)
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -537,10 +1153,37 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
     else {
       int nx = gnext(n);
       if (nx == 0)
-        return luaO_nilobject;  /* not found */
+        break;  /* not found */
       n += nx;
     }
   }
+#else
+  lua_assert(key->tt == LUA_TSHRSTR);
+  if (!isdummy(t)) {
+    unsigned int h = key->hash;
+    unsigned int g, s;
+    Node *n = gnode(t, homeindex(t, h));
+    if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key))
+      return gval(n);  /* at its home node */
+    for (g = firstgroup(t, h), s = 1; ; g = nextgroup(t, g, s++)) {
+      Group c = loadgroup(t, g);
+      Group m;
+      for (m = matchbyte(c, ctrlbyte(h)); m != 0; m &= m - 1) {
+        n = gnode(t, groupnode(g, m));
+        if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key))
+          return gval(n);  /* that's it */
+      }
+      if (matchempty(c))
+        break;  /* not found */
+    }
+  }
+#endif
+  if (ismigrating(t)) {
+    TValue ko;
+    setsvalue(cast(lua_State *, NULL), &ko, key);
+    return getold(t, &ko);
+  }
+  return luaO_nilobject;
 }
 
 
@@ -549,17 +1192,10 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
-  Node *n = mainposition(t, key);
-  for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (luaV_rawequalobj(gkey(n), key))
-      return gval(n);  /* that's it */
-    else {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
-      n += nx;
-    }
-  }
+  Node *n = findnode(t, key);
+  if (n != NULL)
+    return gval(n);
+  return getold(t, key);  /* not found (in current hash part) */
 }
 
 
@@ -646,35 +1282,70 @@ static int unbound_search (Table *t, unsigned int j) {
 }
 
 
+/*
+** true if 'j' is a border of 't': 't[j]' is present (or 'j' is 0) and
+** 't[j + 1]' is not
+*/
+static int isborder (Table *t, unsigned int j) {
+  return ((j == 0 || !ttisnil(luaH_getint(t, j))) &&
+          ttisnil(luaH_getint(t, cast(lua_Integer, j) + 1)));
+}
+
+
 /*
 ** Try to find a boundary in table 't'. A 'boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** The last boundary found is kept in 't->border' and checked first,
+** together with its neighbors, which are where pushes ('t[#t + 1] = v')
+** and pops ('t[#t] = nil') move it; it is only trusted in the part
+** of the table where the boundary would be searched for anyway.
 */
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
+  unsigned int b = t->border;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
-    /* there is a boundary in the array part: (binary) search for it */
+    /* there is a boundary in the array part */
     unsigned int i = 0;
-    while (j - i > 1) {
+    if (b < j) {  /* try the last boundary found */
+      if (isborder(t, b))
+        return b;
+      else if (b + 1 < j && isborder(t, b + 1))
+        return (t->border = b + 1);  /* after a push */
+      else if (b > 0 && isborder(t, b - 1))
+        return (t->border = b - 1);  /* after a pop */
+    }
+    while (j - i > 1) {  /* (binary) search for it */
       unsigned int m = (i+j)/2;
       if (ttisnil(&t->array[m - 1])) j = m;
       else i = m;
     }
-    return i;
+    return (t->border = i);
   }
   /* else must find a boundary in hash part */
   else if (isdummy(t))  /* hash part is empty? */
     return j;  /* that is easy... */
-  else return unbound_search(t, j);
+  else {
+    if (b > j && b < cast(unsigned int, MAX_INT)) {  /* in hash part? */
+      if (isborder(t, b))
+        return b;
+      else if (isborder(t, b + 1))
+        return (t->border = b + 1);  /* after a push */
+      else if (b - 1 > j && isborder(t, b - 1))
+        return (t->border = b - 1);  /* after a pop */
+    }
+    return (t->border = unbound_search(t, j));
+  }
 }
 
 
 
 #if defined(LUA_DEBUG)
 
+#if !defined(LUAI_SWISSTABLE)
 Node *luaH_mainposition (const Table *t, const TValue *key) {
   return mainposition(t, key);
 }
+#endif
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
 
@@ -27,14 +27,36 @@
 #define invalidateTMcache(t)	((t)->flags = 0)
 
 
+#if defined(LUAI_SWISSTABLE)
+
+/* true when 't' is using 'dummynode' as its hash part */
+#define isdummy(t)		((t)->lsizenode == 0)
+
+/* bytes taken by a hash part with 'n' nodes and their control bytes */
+#define sizenodevector(n)	(cast(size_t, (n)) * (sizeof(Node) + 1))
+
+#else
+
 /* true when 't' is using 'dummynode' as its hash part */
 #define isdummy(t)		((t)->lastfree == NULL)
 
+/* bytes taken by a hash part with 'n' nodes */
+#define sizenodevector(n)	(cast(size_t, (n)) * sizeof(Node))
+
+#endif
+
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/* true while 't' is migrating nodes from a previous hash part */
+#define ismigrating(t)		((t)->oldnode != NULL)
+
+/* size of the previous hash part */
+#define sizeold(t)		(twoto((t)->lsizeold))
+
+
 /* returns the key, given the value of a table entry */
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
@@ -53,12 +75,16 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_trim (lua_State *L, Table *t);
+LUAI_FUNC void luaH_clear (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
 
 #if defined(LUA_DEBUG)
+#if !defined(LUAI_SWISSTABLE)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
+#endif
 LUAI_FUNC int luaH_isdummy (const Table *t);
 #endif
 
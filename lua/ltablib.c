@@ -225,6 +225,40 @@ static int unpack (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** New/Clear
+** =======================================================
+*/
+
+/*
+** creates a table with room for 'narr' array elements and 'nrec' other
+** elements, so that filling it up to that does not rehash it
+*/
+static int tnew (lua_State *L) {
+  lua_Integer narr = luaL_optinteger(L, 1, 0);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr < INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec < INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** removes all entries of a table, but keeps its memory, so that it can
+** be filled again without allocating
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Quicksort
@@ -436,6 +470,8 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"clear", tclear},
   {NULL, NULL}
 };
 
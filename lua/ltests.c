@@ -665,7 +665,12 @@ static int hash_query (lua_State *L) {
     Table *t;
     luaL_checktype(L, 2, LUA_TTABLE);
     t = hvalue(obj_at(L, 2));
+#if !defined(LUAI_SWISSTABLE)
     lua_pushinteger(L, luaH_mainposition(t, o) - t->node);
+#else
+    (void)o; (void)t;
+    lua_pushnil(L);  /* open-addressing tables have no main positions */
+#endif
   }
   return 1;
 }
@@ -688,7 +693,11 @@ static int table_query (lua_State *L) {
   if (i == -1) {
     lua_pushinteger(L, t->sizearray);
     lua_pushinteger(L, allocsizenode(t));
+#if !defined(LUAI_SWISSTABLE)
     lua_pushinteger(L, isdummy(t) ? 0 : t->lastfree - t->node);
+#else
+    lua_pushinteger(L, t->nempty);
+#endif
   }
   else if ((unsigned int)i < t->sizearray) {
     lua_pushinteger(L, i);
@@ -724,6 +733,8 @@ static int string_query (lua_State *L) {
   else if (s < tb->size) {
     TString *ts;
     int n = 0;
+    if (tb->old != NULL && s % tb->oldsize >= tb->moved)
+      return 0;  /* bucket not initialized yet */
     for (ts = tb->hash[s]; ts != NULL; ts = ts->u.hnext) {
       setsvalue2s(L, L->top, ts);
       api_incr_top(L);
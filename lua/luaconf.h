@@ -719,6 +719,35 @@
 #define luai_apicheck(l,e)	assert(e)
 #endif
 
+
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch opcodes through a
+** table of label addresses (a GNU C extension), with a copy of the
+** dispatch at the end of each opcode, instead of a 'switch'; each copy
+** is an indirect branch predicted on its own, after its own opcode.
+** It is the default for GCC and compatible compilers (the kernel is
+** always built with one of them). DEFINE it as 0 to use the 'switch'.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_SUPERINSTR makes the compiler fuse frequent pairs of
+** instructions into superinstructions (see 'luaK_finish'), which the
+** interpreter runs with a single dispatch. That is only possible with
+** LUA_USE_JUMPTABLE, so it follows it by default. DEFINE it as 0 to
+** keep the code as generated.
+*/
+#if !defined(LUA_USE_SUPERINSTR)
+#define LUA_USE_SUPERINSTR	LUA_USE_JUMPTABLE
+#endif
+
 /* }================================================================== */
 
 
@@ -743,6 +772,17 @@
 #endif
 
 
+/*
+@@ LUAI_SWISSTABLE makes the hash part of tables an open-addressing
+** table probed in groups of 8 nodes, instead of chained scatter.
+** DEFINE it to trade some memory (one byte per node and at least 1/8
+** of the nodes left empty) and slower hits in large tables for faster
+** misses and insertions, and for integer keys that collide in their
+** low bits (e.g., multiples of a power of 2).
+*/
+/* #define LUAI_SWISSTABLE */
+
+
 /*
 @@ LUA_EXTRASPACE defines the size of a raw memory area associated with
 ** a Lua state with very fast access.
@@ -856,7 +896,16 @@ static inline int time(void *p)
   getnstimeofday(&t);
   return t.tv_sec;
 }
-#define luai_makeseed()	        cast(unsigned int, time(NULL))
+
+/* random.h */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#define luai_makeseed()		cast(unsigned int, get_random_u32())
+#else
+#define luai_makeseed()		cast(unsigned int, get_random_int())
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
+#define luai_makekey(k)		get_random_once((k), sizeof(k))
+#endif
 
 /* stdio.h */
 #include <linux/printk.h>
@@ -876,6 +925,14 @@ static inline int time(void *p)
 /* signal.h */
 #define l_signalT	lu_byte
 
+/* lstate.h: lets the shrinker know when a state is idle (lunatik_alloc.c) */
+struct lua_State;
+extern void lunatik_lock(struct lua_State *L);
+extern void lunatik_unlock(struct lua_State *L);
+#define lua_lock(L)		lunatik_lock(L)
+#define lua_unlock(L)		lunatik_unlock(L)
+#define luai_threadyield(L)	((void)(L))
+
 /* limits.h */
 #define UCHAR_MAX	(255)
 #define CHAR_BIT	(8)
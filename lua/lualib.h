@@ -47,6 +47,21 @@ LUAMOD_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUAMOD_API int (luaopen_package) (lua_State *L);
 
+#define LUA_ARRAYLIBNAME	"array"
+LUAMOD_API int (luaopen_array) (lua_State *L);
+
+#define LUA_INTMAPLIBNAME	"intmap"
+LUAMOD_API int (luaopen_intmap) (lua_State *L);
+
+#define LUA_LRULIBNAME	"lru"
+LUAMOD_API int (luaopen_lru) (lua_State *L);
+
+#define LUA_LPMLIBNAME	"lpm"
+LUAMOD_API int (luaopen_lpm) (lua_State *L);
+
+#define LUA_BITSETLIBNAME	"bitset"
+LUAMOD_API int (luaopen_bitset) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -688,6 +688,43 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** Find method 'key' (a constant with inline cache 'kc') of object 'o'
+** that is not in 'o' itself, when the field '__index' of the metatable
+** of 'o' is a table that has it; the cache remembers where both were
+** found. Returns NULL in any other case, which is left to
+** 'luaV_finishget'.
+*/
+static const TValue *getmethod (lua_State *L, const TValue *o,
+                                const TValue *key, KCache *kc) {
+  Table *mt;
+  const TValue *index;
+  switch (ttnov(o)) {  /* (same as 'luaT_gettmbyobj') */
+    case LUA_TTABLE: mt = hvalue(o)->metatable; break;
+    case LUA_TUSERDATA: mt = uvalue(o)->metatable; break;
+    default: mt = G(L)->mt[ttnov(o)];
+  }
+  if (mt == NULL)
+    return NULL;
+  if (mt->layout == kc->mtlayout && ttistable(kc->index) &&
+      hvalue(kc->index)->layout == kc->layout && !ttisnil(kc->slot))
+    return kc->slot;  /* neither table changed its layout */
+  index = luaH_getshortstr(mt, G(L)->tmname[TM_INDEX]);
+  if (ttistable(index) && ttisshrstring(key)) {
+    Table *h = hvalue(index);
+    const TValue *slot = luaH_getshortstr(h, tsvalue(key));
+    if (!ttisnil(slot)) {
+      kc->mtlayout = mt->layout;
+      kc->index = index;
+      kc->layout = h->layout;
+      kc->slot = slot;
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -708,16 +745,18 @@ void luaV_finishOp (lua_State *L) {
 #else /* _KERNEL */
     case OP_MOD:
 #endif /* _KERNEL */
-    case OP_UNM: case OP_BNOT: case OP_LEN:
-    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF: {
+    case OP_UNM: case OP_BNOT: case OP_LEN: case OP_ADDI: case OP_SUBI:
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF:
+    case OP_GETFIELD: case OP_GETI: case OP_GETFIELD2: {
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
     }
-    case OP_LE: case OP_LT: case OP_EQ: {
+    case OP_LE: case OP_LT: case OP_EQ:
+    case OP_LEI: case OP_LTI: case OP_GEI: case OP_GTI: {
       int res = !l_isfalse(L->top - 1);
       L->top--;
       if (ci->callstatus & CIST_LEQ) {  /* "<=" using "<" instead? */
-        lua_assert(op == OP_LE);
+        lua_assert(op == OP_LE || op == OP_LEI || op == OP_GEI);
         ci->callstatus ^= CIST_LEQ;  /* clear mark */
         res = !res;  /* negate result */
       }
@@ -751,6 +790,7 @@ void luaV_finishOp (lua_State *L) {
       break;
     }
     case OP_TAILCALL: case OP_SETTABUP: case OP_SETTABLE:
+    case OP_SETFIELD: case OP_SETI:
       break;
     default: lua_assert(0);
   }
@@ -789,6 +829,13 @@ void luaV_finishOp (lua_State *L) {
 /* for test instructions, execute the jump instruction that follows it */
 #define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); }
 
+/*
+** for comparison instructions, skip the jump instruction that follows
+** them if their result 'res' is not the expected one (A), or execute it
+*/
+#define condjump(ci,i,res) \
+  { if ((res) != GETARG_A(i)) ci->u.l.savedpc++; else donextjump(ci); }
+
 
 #define Protect(x)	{ {x;}; base = ci->u.l.base; }
 
@@ -811,6 +858,7 @@ void luaV_finishOp (lua_State *L) {
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
+#define vmfuse(o)	vmbreak  /* a superinstruction is its first part */
 
 
 /*
@@ -822,18 +870,51 @@ void luaV_finishOp (lua_State *L) {
   else Protect(luaV_finishget(L,t,k,v,slot)); }
 
 
+/*
+** 'luaV_fastget' for a constant short string 'key', going through its
+** inline cache 'kc' first: while the layout of table 't' is the one
+** the cache remembers, the slot of 'key' in 't' stays the same.
+*/
+#define cachedget(t,key,kc,slot) \
+  (!ttistable(t) ? (slot = NULL, 0) : \
+   (hvalue(t)->layout == (kc)->layout && !ttisnil((kc)->slot)) \
+   ? (slot = (kc)->slot, 1) \
+   : (slot = luaH_getshortstr(hvalue(t), key), \
+      ttisnil(slot) ? 0 \
+      : ((kc)->layout = hvalue(t)->layout, (kc)->slot = slot, 1)))
+
+
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
   if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/*
+** order comparison of register B with the immediate sC; the operands
+** of 'f' are swapped when 'inv' is true (that is, for '>' and '>=')
+*/
+#define orderI(L,i,op,f,inv) { \
+  TValue *rb = RB(i); \
+  lua_Integer ic = GETARG_sC(i); \
+  if (ttisinteger(rb)) \
+    condjump(ci, i, ivalue(rb) op ic) \
+  else { \
+    TValue vc; \
+    setivalue(&vc, ic); \
+    Protect(condjump(ci, i, (inv) ? f(L, &vc, rb) : f(L, rb, &vc))) \
+  } }
+
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
@@ -881,8 +962,17 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        int c = GETARG_C(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        if (ISK(c) && ttisshrstring(rc)) {  /* has an inline cache? */
+          const TValue *slot;
+          KCache *kc = cl->p->kcache + INDEXK(c);
+          if (cachedget(upval, tsvalue(rc), kc, slot)) {
+            setobj2s(L, ra, slot);
+          }
+          else Protect(luaV_finishget(L, upval, rc, ra, slot));
+        }
+        else gettableProtected(L, upval, rc, ra);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -923,13 +1013,22 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_SELF) {
         const TValue *aux;
         StkId rb = RB(i);
+        int c = GETARG_C(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
         if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         }
-        else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        else {
+          const TValue *m = NULL;
+          if (ISK(c))  /* method from the metatable, through its cache? */
+            m = getmethod(L, rb, rc, cl->p->kcache + INDEXK(c));
+          if (m != NULL) {
+            setobj2s(L, ra, m);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
         vmbreak;
       }
       vmcase(OP_ADD) {
@@ -1176,30 +1275,38 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
-          if (luaV_equalobj(L, rb, rc) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+#ifdef _KERNEL  /* integers are the only numbers: compare them here */
+        if (ttisinteger(rb) && ttisinteger(rc))
+          condjump(ci, i, ivalue(rb) == ivalue(rc))
+        else
+#endif /* _KERNEL */
+        Protect(condjump(ci, i, luaV_equalobj(L, rb, rc)))
         vmbreak;
       }
       vmcase(OP_LT) {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+#ifdef _KERNEL
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisinteger(rb) && ttisinteger(rc))
+          condjump(ci, i, ivalue(rb) < ivalue(rc))
+        else
+          Protect(condjump(ci, i, luaV_lessthan(L, rb, rc)))
+#else /* _KERNEL */
+        Protect(condjump(ci, i, luaV_lessthan(L, RKB(i), RKC(i))))
+#endif /* _KERNEL */
         vmbreak;
       }
       vmcase(OP_LE) {
-        Protect(
-          if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+#ifdef _KERNEL
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisinteger(rb) && ttisinteger(rc))
+          condjump(ci, i, ivalue(rb) <= ivalue(rc))
+        else
+          Protect(condjump(ci, i, luaV_lessequal(L, rb, rc)))
+#else /* _KERNEL */
+        Protect(condjump(ci, i, luaV_lessequal(L, RKB(i), RKC(i))))
+#endif /* _KERNEL */
         vmbreak;
       }
       vmcase(OP_TEST) {
@@ -1423,6 +1530,149 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_GETFIELD) {
+        const TValue *slot;
+        StkId rb = RB(i);
+        TValue *rc = k + GETARG_C(i);
+        TString *key = tsvalue(rc);  /* key must be a short string */
+        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+          setobj2s(L, ra, slot);
+        }
+        else Protect(luaV_finishget(L, rb, rc, ra, slot));
+        vmbreak;
+      }
+      vmcase(OP_GETI) {
+        const TValue *slot;
+        StkId rb = RB(i);
+        int c = GETARG_C(i);
+        if (luaV_fastget(L, rb, c, slot, luaH_getint)) {
+          setobj2s(L, ra, slot);
+        }
+        else {
+          TValue key;
+          setivalue(&key, c);
+          Protect(luaV_finishget(L, rb, &key, ra, slot));
+        }
+        vmbreak;
+      }
+      vmcase(OP_SETFIELD) {
+        const TValue *slot;
+        TValue *rb = k + GETARG_B(i);
+        TValue *rc = RKC(i);
+        TString *key = tsvalue(rb);  /* key must be a short string */
+        if (!luaV_fastset(L, ra, key, slot, luaH_getshortstr, rc))
+          Protect(luaV_finishset(L, ra, rb, rc, slot));
+        vmbreak;
+      }
+      vmcase(OP_SETI) {
+        const TValue *slot;
+        int b = GETARG_B(i);
+        TValue *rc = RKC(i);
+        if (!luaV_fastset(L, ra, b, slot, luaH_getint, rc)) {
+          TValue key;
+          setivalue(&key, b);
+          Protect(luaV_finishset(L, ra, &key, rc, slot));
+        }
+        vmbreak;
+      }
+      vmcase(OP_ADDI) {
+        TValue *rb = RB(i);
+        lua_Integer ic = GETARG_sC(i);
+#ifndef _KERNEL
+        lua_Number nb;
+        if (ttisinteger(rb)) {
+          lua_Integer ib = ivalue(rb);
+          setivalue(ra, intop(+, ib, ic));
+        }
+        else if (tonumber(rb, &nb)) {
+          setfltvalue(ra, luai_numadd(L, nb, cast_num(ic)));
+        }
+#else /* _KERNEL */
+        lua_Integer ib;
+        if (tointeger(rb, &ib)) {
+          setivalue(ra, intop(+, ib, ic));
+        }
+#endif /* _KERNEL */
+        else {
+          TValue vc;
+          setivalue(&vc, ic);
+          Protect(luaT_trybinTM(L, rb, &vc, ra, TM_ADD));
+        }
+        vmbreak;
+      }
+      vmcase(OP_SUBI) {
+        TValue *rb = RB(i);
+        lua_Integer ic = GETARG_sC(i);
+#ifndef _KERNEL
+        lua_Number nb;
+        if (ttisinteger(rb)) {
+          lua_Integer ib = ivalue(rb);
+          setivalue(ra, intop(-, ib, ic));
+        }
+        else if (tonumber(rb, &nb)) {
+          setfltvalue(ra, luai_numsub(L, nb, cast_num(ic)));
+        }
+#else /* _KERNEL */
+        lua_Integer ib;
+        if (tointeger(rb, &ib)) {
+          setivalue(ra, intop(-, ib, ic));
+        }
+#endif /* _KERNEL */
+        else {
+          TValue vc;
+          setivalue(&vc, ic);
+          Protect(luaT_trybinTM(L, rb, &vc, ra, TM_SUB));
+        }
+        vmbreak;
+      }
+      vmcase(OP_EQI) {  /* never calls metamethods */
+        TValue *rb = RB(i);
+        lua_Integer ic = GETARG_sC(i);
+        if (ttisinteger(rb))
+          condjump(ci, i, ivalue(rb) == ic)
+        else {
+          TValue vc;
+          setivalue(&vc, ic);
+          condjump(ci, i, luaV_rawequalobj(rb, &vc))
+        }
+        vmbreak;
+      }
+      vmcase(OP_LTI) {
+        orderI(L, i, <, luaV_lessthan, 0);
+        vmbreak;
+      }
+      vmcase(OP_LEI) {
+        orderI(L, i, <=, luaV_lessequal, 0);
+        vmbreak;
+      }
+      vmcase(OP_GTI) {
+        orderI(L, i, >, luaV_lessthan, 1);
+        vmbreak;
+      }
+      vmcase(OP_GEI) {
+        orderI(L, i, >=, luaV_lessequal, 1);
+        vmbreak;
+      }
+      vmcase(OP_MOVE2) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_MOVE);
+      }
+      vmcase(OP_LOADK2) {
+        TValue *rb = k + GETARG_Bx(i);
+        setobj2s(L, ra, rb);
+        vmfuse(OP_LOADK);
+      }
+      vmcase(OP_GETFIELD2) {
+        const TValue *slot;
+        StkId rb = RB(i);
+        TValue *rc = k + GETARG_C(i);
+        TString *key = tsvalue(rc);
+        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+          setobj2s(L, ra, slot);
+        }
+        else Protect(luaV_finishget(L, rb, rc, ra, slot));
+        vmfuse(OP_GETFIELD);
+      }
     }
   }
 }
@@ -0,0 +1,75 @@
+/*
+* Copyright (C) 2018 CUJO LLC.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef lunatik_h
+#define lunatik_h
+
+#include "lua/lua.h"
+
+/*
+** Per-state allocator. Every state created through 'lunatik_newstate'
+** owns a heap that keeps the exact number of bytes it has allocated and
+** serves Lua's common object sizes from dedicated kmem_caches; larger
+** blocks go through krealloc. The heap is released together with the
+** last block of its state (i.e., on 'lua_close').
+**
+** 'lunatik_newstatex' caps the heap at 'budget' bytes (0 means no cap);
+** allocations over it fail into Lua's regular memory error path. When
+** 'arena' is not 0, that many bytes are preallocated (with vmalloc, so
+** from process context only) and the state carves its blocks from them
+** before falling back to the caches. Like 'lua_newstate', neither sets
+** a panic function.
+**
+** States start as non-sleepable and allocate with GFP_ATOMIC. Once a
+** state is declared sleepable by 'lunatik_setsleepable', it allocates
+** with GFP_KERNEL and blocks above a page (large arrays, node vectors,
+** long strings and stacks) may be backed by vmalloc; such a state must
+** then only run in process context.
+**
+** Under memory pressure, the module's shrinker collects garbage from
+** states that are idle (i.e., no thread is running them) and gives the
+** freed memory back to the system.
+*/
+typedef struct lunatik_memstat {
+	size_t used;  /* bytes currently allocated by the state */
+	size_t peak;  /* high-water mark of 'used' */
+	size_t budget;
+	size_t arena;
+	size_t arenaused;  /* bytes currently carved from the arena */
+	size_t arenapeak;  /* high-water mark of 'arenaused' */
+} lunatik_memstat;
+
+void *lunatik_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+lua_State *lunatik_newstate(void);
+lua_State *lunatik_newstatex(size_t budget, size_t arena);
+int lunatik_getmemstat(lua_State *L, lunatik_memstat *ms);
+int lunatik_setsleepable(lua_State *L, bool sleepable);
+
+int lunatik_allocinit(void);
+void lunatik_allocexit(void);
+size_t lunatik_reclaimable(void);
+size_t lunatik_reclaim(size_t nr);
+
+struct seq_file;
+void lunatik_showheaps(struct seq_file *m);
+
+#endif /* lunatik_h */
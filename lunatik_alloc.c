@@ -0,0 +1,856 @@
+/*
+* Copyright (C) 2018 CUJO LLC.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifdef __linux__
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/jiffies.h>
+#include <linux/seq_file.h>
+
+#include "lua/lstate.h"
+#include "lua/lgc.h"
+#include "lua/lfunc.h"
+#include "lua/lstring.h"
+#include "lua/ltable.h"
+
+#include "lunatik.h"
+
+/*
+** Sleepable states may place blocks above this size (large table parts,
+** node vectors, long strings and stacks) in virtually contiguous memory,
+** so they do not depend on high-order pages.
+*/
+#define LUNATIK_KVMIN		(PAGE_SIZE)
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+#define lunatik_kvmalloc(s)	kvmalloc((s), GFP_KERNEL)
+#else
+#define lunatik_kvmalloc(s)	vmalloc(s)
+#endif
+
+/*
+** Size classes served by dedicated caches. They cover short strings,
+** tables, small node vectors, closures, upvalues, userdata headers,
+** CallInfo and Proto (see lobject.h and lstate.h); any block above the
+** largest class is handled by krealloc.
+*/
+#define LUNATIK_CLASSMAX	(256)
+#define LUNATIK_CLASSSHIFT	(4)
+#define LUNATIK_ALIGN(s)	ALIGN((s), 1 << LUNATIK_CLASSSHIFT)
+
+static const unsigned int lunatik_classsize[] = {
+	16, 32, 48, 64, 80, 96, 128, 192, 256
+};
+
+static const char *const lunatik_classname[] = {
+	"lunatik-16", "lunatik-32", "lunatik-48", "lunatik-64", "lunatik-80",
+	"lunatik-96", "lunatik-128", "lunatik-192", "lunatik-256"
+};
+
+#define LUNATIK_NCLASSES	ARRAY_SIZE(lunatik_classsize)
+
+/* maps '(size - 1) >> LUNATIK_CLASSSHIFT' into its size class */
+static const unsigned char lunatik_sizeclass[LUNATIK_CLASSMAX >> LUNATIK_CLASSSHIFT] = {
+	0, 1, 2, 3, 4, 5, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8
+};
+
+static struct kmem_cache *lunatik_cache[LUNATIK_NCLASSES];
+
+/*
+** The arena is a preallocated region carved in 16-byte multiples.
+** Small blocks are recycled through per-class lists; larger ones go back
+** to an address-ordered list of free extents, where they are merged with
+** their neighbours. As Lua gives the size of every block it frees, the
+** arena needs no per-block header.
+*/
+typedef struct lunatik_extent {
+	struct lunatik_extent *next;
+	size_t size;
+} lunatik_extent;
+
+typedef struct lunatik_arena {
+	char *base;
+	size_t size;
+	size_t used;  /* bytes carved from the arena and not given back */
+	size_t peak;  /* high-water mark of 'used' */
+	lunatik_extent *free;  /* address-ordered free extents */
+	void *quick[LUNATIK_NCLASSES];  /* recycled small blocks */
+} lunatik_arena;
+
+/*
+** Lua assumes that shrinking a block never fails. When a shrunk block
+** would have to move to another cache (or inside the arena) and there
+** is no memory left for the copy, it stays where it is, with a record
+** of the size it was actually allocated with right after the bytes Lua
+** uses. That space is always there: the block is at least one class
+** (16 bytes) larger, and large blocks take at least LUNATIK_LARGEMIN
+** bytes. The records of a heap are hashed by their addresses, so a
+** block is found by the address its record would have. The buckets
+** start in the heap itself and double when there are more records than
+** buckets (if there is memory for that; otherwise chains just grow).
+*/
+typedef struct lunatik_inplace {
+	struct lunatik_inplace *next;  /* in the same bucket */
+	size_t size;  /* actual size of the block */
+} lunatik_inplace;
+
+#define LUNATIK_INPLACEBITS	(3)
+
+#define LUNATIK_LARGEMIN	(LUNATIK_CLASSMAX + sizeof(lunatik_inplace))
+
+/*
+** Allocations are counted by size in powers of two, from up to 16 bytes
+** to up to 16K; the last bucket also holds the larger ones.
+*/
+#define LUNATIK_NHIST		(12)
+
+typedef struct lunatik_heap {
+	size_t used;  /* exact number of bytes allocated by the state */
+	size_t peak;  /* high-water mark of 'used' */
+	size_t budget;  /* maximum value of 'used' (0 means unlimited) */
+	lunatik_arena arena;
+	gfp_t gfp;  /* GFP_KERNEL if the state is sleepable, else GFP_ATOMIC */
+	bool pinned;  /* keeps the heap alive while the state is being built */
+	lunatik_inplace **inplace;  /* buckets of blocks kept in place */
+	unsigned int inplacebits;  /* log2 of the number of buckets */
+	unsigned int ninplace;  /* number of blocks kept in place */
+	lunatik_inplace *inplacemin[1 << LUNATIK_INPLACEBITS];
+	lua_State *L;  /* main thread */
+	struct list_head entry;  /* in 'lunatik_heaps' */
+	atomic_t core;  /* 1 while running the Lua core, -1 while shrunk */
+	unsigned int id;
+	unsigned long born;  /* in jiffies */
+	unsigned long nalloc;
+	unsigned long nrealloc;
+	unsigned long nfree;
+	unsigned long hist[LUNATIK_NHIST];  /* sizes of allocated blocks */
+} lunatik_heap;
+
+/*
+** Every state is on 'lunatik_heaps' so the shrinker can find it. It is
+** shrunk only while no thread runs inside its Lua core. 'lua_lock' and
+** 'lua_unlock' (see luaconf.h) are strictly paired and never nest, so
+** they only flip 'core' between 0 and 1 (an acquire and a release, with
+** no full barrier on the path of every API call), and the shrinker
+** claims an idle heap by swapping 'core' from 0 to -1, making threads
+** that enter meanwhile wait. As the shrinker holds a heap with bottom
+** halves disabled and allocates with GFP_ATOMIC, that wait is short and
+** states keep running in any context.
+*/
+static LIST_HEAD(lunatik_heaps);
+static DEFINE_SPINLOCK(lunatik_heapslock);
+static unsigned int lunatik_nheaps;
+static unsigned int lunatik_lastid;
+
+/* returns the size class of a non-empty block or -1 if it has none */
+static inline int lunatik_class(size_t size)
+{
+	return size <= LUNATIK_CLASSMAX ?
+		lunatik_sizeclass[(size - 1) >> LUNATIK_CLASSSHIFT] : -1;
+}
+
+/* returns the number of arena bytes taken by a block of 'size' bytes */
+static inline size_t lunatik_arenasize(size_t size)
+{
+	int c = lunatik_class(size);
+	return c >= 0 ? lunatik_classsize[c] : LUNATIK_ALIGN(size);
+}
+
+static inline bool lunatik_inarena(lunatik_arena *arena, void *ptr)
+{
+	return (char *)ptr >= arena->base &&
+		(char *)ptr < arena->base + arena->size;
+}
+
+static void *lunatik_carve(lunatik_arena *arena, size_t size)
+{
+	lunatik_extent **p;
+
+	for (p = &arena->free; *p != NULL; p = &(*p)->next) {
+		lunatik_extent *e = *p;
+		if (e->size == size) {
+			*p = e->next;
+			return e;
+		}
+		else if (e->size > size) {
+			lunatik_extent *rest = (lunatik_extent *)((char *)e + size);
+			rest->size = e->size - size;
+			rest->next = e->next;
+			*p = rest;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void lunatik_uncarve(lunatik_arena *arena, void *ptr, size_t size)
+{
+	lunatik_extent **p = &arena->free;
+	lunatik_extent *prev = NULL;
+	lunatik_extent *e = (lunatik_extent *)ptr;
+
+	while (*p != NULL && (char *)*p < (char *)ptr) {
+		prev = *p;
+		p = &prev->next;
+	}
+
+	e->size = size;
+	e->next = *p;
+	if (e->next != NULL && (char *)e + e->size == (char *)e->next) {
+		e->size += e->next->size;
+		e->next = e->next->next;
+	}
+
+	if (prev != NULL && (char *)prev + prev->size == (char *)e) {
+		prev->size += e->size;
+		prev->next = e->next;
+	}
+	else
+		*p = e;
+}
+
+static void *lunatik_arenaalloc(lunatik_arena *arena, size_t size)
+{
+	int c = lunatik_class(size);
+	size_t asize = lunatik_arenasize(size);
+	void *ptr;
+
+	if (c >= 0 && (ptr = arena->quick[c]) != NULL)
+		arena->quick[c] = *(void **)ptr;
+	else if ((ptr = lunatik_carve(arena, asize)) == NULL)
+		return NULL;
+
+	arena->used += asize;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+	return ptr;
+}
+
+static void lunatik_arenafree(lunatik_arena *arena, void *ptr, size_t size)
+{
+	int c = lunatik_class(size);
+	size_t asize = lunatik_arenasize(size);
+
+	if (c >= 0) {
+		*(void **)ptr = arena->quick[c];
+		arena->quick[c] = ptr;
+	}
+	else
+		lunatik_uncarve(arena, ptr, asize);
+	arena->used -= asize;
+}
+
+static inline bool lunatik_usekv(lunatik_heap *heap, size_t size)
+{
+	return heap->gfp == GFP_KERNEL && size > LUNATIK_KVMIN;
+}
+
+static inline void lunatik_largefree(void *ptr)
+{
+	if (is_vmalloc_addr(ptr))
+		vfree(ptr);
+	else
+		kfree(ptr);
+}
+
+static inline void *lunatik_malloc(lunatik_heap *heap, size_t size)
+{
+	int c;
+	void *ptr;
+
+	if (heap->arena.base != NULL &&
+	    (ptr = lunatik_arenaalloc(&heap->arena, size)) != NULL)
+		return ptr;
+
+	if ((c = lunatik_class(size)) >= 0)
+		return kmem_cache_alloc(lunatik_cache[c], heap->gfp);
+	return lunatik_usekv(heap, size) ? lunatik_kvmalloc(size) :
+		kmalloc(max_t(size_t, size, LUNATIK_LARGEMIN), heap->gfp);
+}
+
+static inline void lunatik_free(lunatik_heap *heap, void *ptr, size_t size)
+{
+	int c;
+
+	if (lunatik_inarena(&heap->arena, ptr)) {
+		lunatik_arenafree(&heap->arena, ptr, size);
+		return;
+	}
+
+	c = lunatik_class(size);
+	if (c >= 0)
+		kmem_cache_free(lunatik_cache[c], ptr);
+	else
+		lunatik_largefree(ptr);
+}
+
+static void *lunatik_realloc(lunatik_heap *heap, void *ptr, size_t osize,
+	size_t nsize)
+{
+	int c = lunatik_class(nsize);
+	void *nptr;
+
+	if (lunatik_inarena(&heap->arena, ptr)) {
+		if (lunatik_arenasize(osize) == lunatik_arenasize(nsize))
+			return ptr;
+	}
+	else if (c >= 0 && c == lunatik_class(osize))  /* same cache? */
+		return ptr;
+	else if (c < 0 && lunatik_class(osize) < 0 && !is_vmalloc_addr(ptr) &&
+		 !lunatik_usekv(heap, nsize))
+		return krealloc(ptr, max_t(size_t, nsize, LUNATIK_LARGEMIN),
+			heap->gfp);
+
+	if ((nptr = lunatik_malloc(heap, nsize)) != NULL) {
+		memcpy(nptr, ptr, min(osize, nsize));
+		lunatik_free(heap, ptr, osize);
+	}
+	return nptr;
+}
+
+/* whether a block of 'bsize' bytes can be freed as one of 'size' bytes */
+static inline bool lunatik_fits(lunatik_heap *heap, void *ptr, size_t bsize,
+	size_t size)
+{
+	return lunatik_inarena(&heap->arena, ptr) ?
+		lunatik_arenasize(bsize) == lunatik_arenasize(size) :
+		lunatik_class(bsize) == lunatik_class(size);
+}
+
+static inline lunatik_inplace *lunatik_inplacerec(void *ptr, size_t size)
+{
+	return (lunatik_inplace *)((char *)ptr + LUNATIK_ALIGN(size));
+}
+
+static inline lunatik_inplace **lunatik_bucket(lunatik_heap *heap,
+	lunatik_inplace *rec)
+{
+	return &heap->inplace[hash_ptr(rec, heap->inplacebits)];
+}
+
+/* removes 'ptr' from the in-place blocks, returning its actual size */
+static size_t lunatik_takeinplace(lunatik_heap *heap, void *ptr, size_t size)
+{
+	lunatik_inplace *rec = lunatik_inplacerec(ptr, size);
+	lunatik_inplace **p;
+
+	for (p = lunatik_bucket(heap, rec); *p != NULL; p = &(*p)->next) {
+		if (*p == rec) {
+			*p = rec->next;
+			heap->ninplace--;
+			return rec->size;
+		}
+	}
+	return size;
+}
+
+/* doubles the buckets of the in-place blocks, if there is memory */
+static void lunatik_growinplace(lunatik_heap *heap)
+{
+	unsigned int i, n = 1U << heap->inplacebits;
+	lunatik_inplace **old = heap->inplace;
+	lunatik_inplace *rec, *next, **p;
+
+	heap->inplace = kzalloc(2 * n * sizeof(lunatik_inplace *),
+		heap->gfp | __GFP_NOWARN);
+	if (heap->inplace == NULL) {
+		heap->inplace = old;
+		return;
+	}
+	heap->inplacebits++;
+	for (i = 0; i < n; i++) {
+		for (rec = old[i]; rec != NULL; rec = next) {
+			next = rec->next;
+			p = lunatik_bucket(heap, rec);
+			rec->next = *p;
+			*p = rec;
+		}
+	}
+	if (old != heap->inplacemin)
+		kfree(old);
+}
+
+/* keeps 'ptr', of 'bsize' bytes, in place as a block of 'size' bytes */
+static void lunatik_keepinplace(lunatik_heap *heap, void *ptr, size_t size,
+	size_t bsize)
+{
+	lunatik_inplace *rec, **p;
+
+	if (lunatik_fits(heap, ptr, bsize, size))
+		return;  /* no record needed */
+	if (heap->ninplace >= 1U << heap->inplacebits)
+		lunatik_growinplace(heap);
+	rec = lunatik_inplacerec(ptr, size);
+	rec->size = bsize;
+	p = lunatik_bucket(heap, rec);
+	rec->next = *p;
+	*p = rec;
+	heap->ninplace++;
+}
+
+static void lunatik_unlink(lunatik_heap *heap)
+{
+	spin_lock_bh(&lunatik_heapslock);
+	list_del(&heap->entry);
+	lunatik_nheaps--;
+	spin_unlock_bh(&lunatik_heapslock);
+}
+
+static void lunatik_freeheap(lunatik_heap *heap)
+{
+	if (heap->arena.base != NULL)
+		vfree(heap->arena.base);
+	if (heap->inplace != heap->inplacemin)
+		kfree(heap->inplace);
+	kfree(heap);
+}
+
+/*
+** Lua always passes the actual block size as 'osize' when 'ptr' is not
+** NULL, so every block can be returned to the cache it came from
+** without any per-block header. Growing past the budget fails as any
+** other allocation, so Lua runs an emergency collection and then raises
+** a memory error. Shrinking never fails.
+*/
+void *lunatik_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	lunatik_heap *heap = (lunatik_heap *)ud;
+	size_t bsize;
+	void *nptr;
+
+	if (ptr == NULL)
+		osize = 0;  /* 'osize' encodes the type of the new object */
+	else if (nsize == osize)
+		return ptr;
+
+	if (heap->budget > 0 && nsize > osize &&
+	    heap->used + (nsize - osize) > heap->budget)
+		return NULL;
+
+	bsize = ptr != NULL && heap->ninplace > 0 ?
+		lunatik_takeinplace(heap, ptr, osize) : osize;
+
+	if (nsize == 0) {
+		if (ptr != NULL) {
+			bool last = heap->used == osize && !heap->pinned;
+
+			heap->nfree++;
+
+			if (last)  /* state is gone */
+				lunatik_unlink(heap);
+			lunatik_free(heap, ptr, bsize);
+			heap->used -= osize;
+			if (last)
+				lunatik_freeheap(heap);
+		}
+		return NULL;
+	}
+
+	nptr = ptr == NULL ? lunatik_malloc(heap, nsize) :
+		lunatik_realloc(heap, ptr, bsize, nsize);
+	if (nptr == NULL && ptr != NULL) {  /* 'ptr' is untouched */
+		if (nsize < osize) {  /* shrinking never fails */
+			lunatik_keepinplace(heap, ptr, nsize, bsize);
+			nptr = ptr;
+		}
+		else
+			lunatik_keepinplace(heap, ptr, osize, bsize);
+	}
+	if (nptr != NULL) {
+		int h = fls_long(nsize - 1) - LUNATIK_CLASSSHIFT;
+
+		heap->hist[clamp(h, 0, LUNATIK_NHIST - 1)]++;
+		if (ptr == NULL)
+			heap->nalloc++;
+		else
+			heap->nrealloc++;
+		heap->used += nsize - osize;
+		if (heap->used > heap->peak)
+			heap->peak = heap->used;
+	}
+	return nptr;
+}
+
+lua_State *lunatik_newstatex(size_t budget, size_t arena)
+{
+	lunatik_heap *heap;
+	lua_State *L;
+
+	if ((heap = kzalloc(sizeof(lunatik_heap), GFP_ATOMIC)) == NULL)
+		return NULL;
+
+	heap->budget = budget;
+	heap->gfp = GFP_ATOMIC;
+	heap->inplace = heap->inplacemin;
+	heap->inplacebits = LUNATIK_INPLACEBITS;
+	arena &= ~(size_t)((1 << LUNATIK_CLASSSHIFT) - 1);
+	if (arena > 0) {
+		lunatik_extent *e;
+
+		if ((heap->arena.base = vmalloc(arena)) == NULL) {
+			kfree(heap);
+			return NULL;
+		}
+		heap->arena.size = arena;
+		e = (lunatik_extent *)heap->arena.base;
+		e->size = arena;
+		e->next = NULL;
+		heap->arena.free = e;
+	}
+
+	heap->pinned = true;
+	L = lua_newstate(lunatik_alloc, heap);
+	heap->pinned = false;
+
+	if (L == NULL) {  /* every block was already given back */
+		lunatik_freeheap(heap);
+		return NULL;
+	}
+
+	heap->L = L;
+	heap->born = jiffies;
+	spin_lock_bh(&lunatik_heapslock);
+	list_add_tail(&heap->entry, &lunatik_heaps);
+	lunatik_nheaps++;
+	heap->id = ++lunatik_lastid;
+	spin_unlock_bh(&lunatik_heapslock);
+	return L;
+}
+
+lua_State *lunatik_newstate(void)
+{
+	return lunatik_newstatex(0, 0);
+}
+
+int lunatik_getmemstat(lua_State *L, lunatik_memstat *ms)
+{
+	lunatik_heap *heap;
+
+	if (lua_getallocf(L, (void **)&heap) != lunatik_alloc)
+		return -EINVAL;
+
+	ms->used = heap->used;
+	ms->peak = heap->peak;
+	ms->budget = heap->budget;
+	ms->arena = heap->arena.size;
+	ms->arenaused = heap->arena.used;
+	ms->arenapeak = heap->arena.peak;
+	return 0;
+}
+
+int lunatik_setsleepable(lua_State *L, bool sleepable)
+{
+	lunatik_heap *heap;
+
+	if (lua_getallocf(L, (void **)&heap) != lunatik_alloc)
+		return -EINVAL;
+
+	lunatik_lock(L);  /* the shrinker may be using 'gfp' */
+	heap->gfp = sleepable ? GFP_KERNEL : GFP_ATOMIC;
+	lunatik_unlock(L);
+	return 0;
+}
+
+static inline lunatik_heap *lunatik_getheap(lua_State *L)
+{
+	global_State *g = G(L);
+
+	return g->frealloc == lunatik_alloc ? (lunatik_heap *)g->ud : NULL;
+}
+
+void lunatik_lock(lua_State *L)
+{
+	lunatik_heap *heap = lunatik_getheap(L);
+
+	if (heap == NULL)
+		return;
+
+	while (unlikely(atomic_cmpxchg_acquire(&heap->core, 0, 1) != 0))
+		while (atomic_read(&heap->core) != 0)  /* being shrunk */
+			cpu_relax();
+}
+
+void lunatik_unlock(lua_State *L)
+{
+	lunatik_heap *heap = lunatik_getheap(L);
+
+	if (heap != NULL)
+		atomic_set_release(&heap->core, 0);
+}
+
+static inline bool lunatik_claim(lunatik_heap *heap)
+{
+	return atomic_cmpxchg(&heap->core, 0, -1) == 0;
+}
+
+static inline void lunatik_release(lunatik_heap *heap)
+{
+	atomic_set_release(&heap->core, 0);
+}
+
+/* bytes of a heap that are not carved from its arena */
+static inline size_t lunatik_outside(lunatik_heap *heap)
+{
+	return heap->used - heap->arena.used;
+}
+
+/*
+** Estimates how many bytes a collection would give back to the system:
+** the garbage accumulated since the last cycle, not counting what would
+** only return to an arena.
+*/
+size_t lunatik_reclaimable(void)
+{
+	lunatik_heap *heap;
+	size_t n = 0;
+
+	spin_lock_bh(&lunatik_heapslock);
+	list_for_each_entry(heap, &lunatik_heaps, entry) {
+		global_State *g = G(heap->L);
+		l_mem garbage = (l_mem)(gettotalbytes(g) - g->GCestimate);
+
+		if (garbage > 0)
+			n += min((size_t)garbage, lunatik_outside(heap));
+	}
+	spin_unlock_bh(&lunatik_heapslock);
+	return n;
+}
+
+/*
+** Shrinks idle states, in round-robin, until about 'nr' bytes are given
+** back or every state was visited once; returns the bytes given back.
+** Busy states are skipped.
+*/
+size_t lunatik_reclaim(size_t nr)
+{
+	size_t freed = 0;
+	unsigned int n;
+
+	spin_lock_bh(&lunatik_heapslock);
+	n = lunatik_nheaps;
+	spin_unlock_bh(&lunatik_heapslock);
+
+	while (n-- > 0 && freed < nr) {
+		lunatik_heap *heap;
+		lua_State *L;
+		size_t outside;
+		gfp_t gfp;
+
+		spin_lock_bh(&lunatik_heapslock);
+		if (list_empty(&lunatik_heaps)) {
+			spin_unlock_bh(&lunatik_heapslock);
+			break;
+		}
+		heap = list_first_entry(&lunatik_heaps, lunatik_heap, entry);
+		list_move_tail(&heap->entry, &lunatik_heaps);
+		if (!lunatik_claim(heap)) {
+			spin_unlock_bh(&lunatik_heapslock);
+			continue;
+		}
+		spin_unlock(&lunatik_heapslock);  /* keep bottom halves off */
+
+		L = heap->L;
+		outside = lunatik_outside(heap);
+		gfp = heap->gfp;
+		heap->gfp = GFP_ATOMIC;
+		if (L->ci == &L->base_ci)  /* not inside a C function? */
+			luaC_shrink(L, (l_mem)min(nr - freed, (size_t)MAX_LMEM));
+		heap->gfp = gfp;
+		if (lunatik_outside(heap) < outside)
+			freed += outside - lunatik_outside(heap);
+
+		lunatik_release(heap);
+		local_bh_enable();
+	}
+	return freed;
+}
+
+/*
+** Breakdown of the memory held by the objects of a state. It is taken
+** by walking the object lists, so it costs nothing until it is asked
+** for; the rest of the heap (upvalues, the string table, recycled
+** blocks, parser buffers and the state itself) is reported as 'other'.
+*/
+enum {
+	LUNATIK_STRINGS, LUNATIK_TABLES, LUNATIK_ARRAYS, LUNATIK_HASHES,
+	LUNATIK_CLOSURES, LUNATIK_USERDATA, LUNATIK_THREADS, LUNATIK_STACKS,
+	LUNATIK_PROTOS, LUNATIK_NKINDS
+};
+
+static const char *const lunatik_kindname[] = {
+	"strings", "tables", "arrays", "hashes", "closures", "userdata",
+	"threads", "stacks", "protos"
+};
+
+static inline size_t lunatik_protosize(Proto *f)
+{
+	return sizeof(Proto) + f->sizecode * sizeof(Instruction) +
+		f->sizep * sizeof(Proto *) + f->sizek * sizeof(TValue) +
+		f->sizelineinfo * sizeof(int) +
+		f->sizelocvars * sizeof(LocVar) +
+		f->sizeupvalues * sizeof(Upvaldesc) +
+		(f->kcache != NULL ? f->sizek * sizeof(KCache) : 0);
+}
+
+static inline size_t lunatik_stacksize(lua_State *L)
+{
+	return L->stacksize * sizeof(TValue) + L->nci * sizeof(CallInfo);
+}
+
+static void lunatik_countobjs(GCObject *o, size_t *kind)
+{
+	for (; o != NULL; o = o->next) {
+		switch (o->tt) {
+		case LUA_TSHRSTR:
+			kind[LUNATIK_STRINGS] += sizelstring(gco2ts(o)->shrlen);
+			break;
+		case LUA_TLNGSTR:
+			kind[LUNATIK_STRINGS] += sizelngstr(gco2ts(o));
+			break;
+		case LUA_TTABLE: {
+			Table *t = gco2t(o);
+
+			kind[LUNATIK_TABLES] += sizeof(Table);
+			kind[LUNATIK_ARRAYS] += t->sizearray * sizeof(TValue);
+			kind[LUNATIK_HASHES] += sizenodevector(allocsizenode(t));
+			if (ismigrating(t))
+				kind[LUNATIK_HASHES] += sizenodevector(sizeold(t));
+			break;
+		}
+		case LUA_TLCL:
+			kind[LUNATIK_CLOSURES] +=
+				sizeLclosure(gco2lcl(o)->nupvalues);
+			break;
+		case LUA_TCCL:
+			kind[LUNATIK_CLOSURES] +=
+				sizeCclosure(gco2ccl(o)->nupvalues);
+			break;
+		case LUA_TUSERDATA:
+			kind[LUNATIK_USERDATA] += sizeudata(gco2u(o));
+			break;
+		case LUA_TTHREAD:
+			kind[LUNATIK_THREADS] +=
+				LUA_EXTRASPACE + sizeof(lua_State);
+			kind[LUNATIK_STACKS] += lunatik_stacksize(gco2th(o));
+			break;
+		case LUA_TPROTO:
+			kind[LUNATIK_PROTOS] += lunatik_protosize(gco2p(o));
+			break;
+		}
+	}
+}
+
+static void lunatik_showkinds(struct seq_file *m, lunatik_heap *heap)
+{
+	global_State *g = G(heap->L);
+	size_t kind[LUNATIK_NKINDS] = {0};
+	size_t other = heap->used;
+	int i;
+
+	lunatik_countobjs(g->allgc, kind);
+	lunatik_countobjs(g->finobj, kind);
+	lunatik_countobjs(g->tobefnz, kind);
+	lunatik_countobjs(g->fixedgc, kind);
+	kind[LUNATIK_STACKS] += lunatik_stacksize(g->mainthread);
+
+	for (i = 0; i < LUNATIK_NKINDS; i++) {
+		seq_printf(m, " %s %zu", lunatik_kindname[i], kind[i]);
+		other -= min(other, kind[i]);
+	}
+	seq_printf(m, " other %zu\n", other);
+}
+
+/*
+** Prints, for every state: its memory usage, how many blocks it has
+** allocated, reallocated and freed since it was created (together with
+** its age, from which rates follow), a histogram of the sizes it has
+** asked for and, if the state is not running, the bytes held by each
+** kind of object.
+*/
+void lunatik_showheaps(struct seq_file *m)
+{
+	lunatik_heap *heap;
+
+	spin_lock_bh(&lunatik_heapslock);
+	list_for_each_entry(heap, &lunatik_heaps, entry) {
+		int i;
+
+		seq_printf(m, "state %u\n", heap->id);
+		seq_printf(m, " age %u ms\n",
+			jiffies_to_msecs(jiffies - heap->born));
+		seq_printf(m, " used %zu peak %zu budget %zu\n",
+			heap->used, heap->peak, heap->budget);
+		seq_printf(m, " arena %zu used %zu peak %zu\n",
+			heap->arena.size, heap->arena.used, heap->arena.peak);
+		seq_printf(m, " allocs %lu reallocs %lu frees %lu\n",
+			heap->nalloc, heap->nrealloc, heap->nfree);
+		seq_puts(m, " sizes");
+		for (i = 0; i < LUNATIK_NHIST; i++)
+			seq_printf(m, " %lu", heap->hist[i]);
+		seq_puts(m, "\n objects");
+		if (lunatik_claim(heap)) {
+			lunatik_showkinds(m, heap);
+			lunatik_release(heap);
+		}
+		else
+			seq_puts(m, " busy\n");
+	}
+	spin_unlock_bh(&lunatik_heapslock);
+}
+
+void lunatik_allocexit(void)
+{
+	int i;
+
+	for (i = 0; i < LUNATIK_NCLASSES; i++) {
+		if (lunatik_cache[i] != NULL)
+			kmem_cache_destroy(lunatik_cache[i]);
+		lunatik_cache[i] = NULL;
+	}
+}
+
+int lunatik_allocinit(void)
+{
+	int i;
+
+	for (i = 0; i < LUNATIK_NCLASSES; i++) {
+		lunatik_cache[i] = kmem_cache_create(lunatik_classname[i],
+			lunatik_classsize[i], 0, 0, NULL);
+		if (lunatik_cache[i] == NULL) {
+			lunatik_allocexit();
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+#endif /* __linux__ */
@@ -22,12 +22,22 @@
 */
 #ifdef __linux__
 #include <linux/module.h>
+#include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,12,0)
+#include <linux/shrinker.h>
+#endif
 
 #include "lua/lua.h"
 #include "lua/lauxlib.h"
 #include "lua/lualib.h"
 
+#include "lunatik.h"
+
 EXPORT_SYMBOL(lua_checkstack);
+EXPORT_SYMBOL(lua_reserve);
 EXPORT_SYMBOL(lua_xmove);
 EXPORT_SYMBOL(lua_atpanic);
 EXPORT_SYMBOL(lua_version);
@@ -59,6 +69,7 @@ EXPORT_SYMBOL(lua_topointer);
 EXPORT_SYMBOL(lua_pushnil);
 EXPORT_SYMBOL(lua_pushinteger);
 EXPORT_SYMBOL(lua_pushlstring);
+EXPORT_SYMBOL(lua_pushexternalstring);
 EXPORT_SYMBOL(lua_pushstring);
 EXPORT_SYMBOL(lua_pushvfstring);
 EXPORT_SYMBOL(lua_pushfstring);
@@ -85,6 +96,7 @@ EXPORT_SYMBOL(lua_rawseti);
 EXPORT_SYMBOL(lua_rawsetp);
 EXPORT_SYMBOL(lua_setmetatable);
 EXPORT_SYMBOL(lua_setuservalue);
+EXPORT_SYMBOL(lua_cleartable);
 EXPORT_SYMBOL(lua_callk);
 EXPORT_SYMBOL(lua_pcallk);
 EXPORT_SYMBOL(lua_load);
@@ -164,14 +176,109 @@ EXPORT_SYMBOL(luaopen_os);
 EXPORT_SYMBOL(luaopen_string);
 EXPORT_SYMBOL(luaopen_table);
 EXPORT_SYMBOL(luaopen_utf8);
+EXPORT_SYMBOL(lunatik_newstate);
+EXPORT_SYMBOL(lunatik_newstatex);
+EXPORT_SYMBOL(lunatik_getmemstat);
+EXPORT_SYMBOL(lunatik_setsleepable);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,12,0)
+static unsigned long lunatik_count(struct shrinker *s,
+        struct shrink_control *sc)
+{
+        return lunatik_reclaimable() >> PAGE_SHIFT;
+}
+
+static unsigned long lunatik_scan(struct shrinker *s,
+        struct shrink_control *sc)
+{
+        size_t freed = lunatik_reclaim(sc->nr_to_scan << PAGE_SHIFT);
+
+        return freed > 0 ? freed >> PAGE_SHIFT : SHRINK_STOP;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+static struct shrinker *lunatik_shrinker;
+#else
+static struct shrinker lunatik_shrinker = {
+        .count_objects = lunatik_count,
+        .scan_objects = lunatik_scan,
+        .seeks = DEFAULT_SEEKS,
+};
+#endif
+
+static int lunatik_shrinkerinit(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+        if ((lunatik_shrinker = shrinker_alloc(0, "lunatik")) == NULL)
+                return -ENOMEM;
+        lunatik_shrinker->count_objects = lunatik_count;
+        lunatik_shrinker->scan_objects = lunatik_scan;
+        shrinker_register(lunatik_shrinker);
+        return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+        return register_shrinker(&lunatik_shrinker, "lunatik");
+#else
+        return register_shrinker(&lunatik_shrinker);
+#endif
+}
+
+static void lunatik_shrinkerexit(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+        shrinker_free(lunatik_shrinker);
+#else
+        unregister_shrinker(&lunatik_shrinker);
+#endif
+}
+#else
+#define lunatik_shrinkerinit()  (0)
+#define lunatik_shrinkerexit()  ((void)0)
+#endif
+
+static struct dentry *lunatik_debugfs;
+
+static int lunatik_heapsshow(struct seq_file *m, void *v)
+{
+        lunatik_showheaps(m);
+        return 0;
+}
+
+static int lunatik_heapsopen(struct inode *inode, struct file *file)
+{
+        return single_open(file, lunatik_heapsshow, NULL);
+}
+
+static const struct file_operations lunatik_heapsfops = {
+        .owner = THIS_MODULE,
+        .open = lunatik_heapsopen,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = single_release,
+};
 
 static int __init modinit(void)
 {
+        int ret;
+
+        if ((ret = lunatik_allocinit()) != 0)
+                return ret;
+        if ((ret = lunatik_shrinkerinit()) != 0) {
+                lunatik_allocexit();
+                return ret;
+        }
+
+        /* debugfs is optional: failing to create it is not an error */
+        lunatik_debugfs = debugfs_create_dir("lunatik", NULL);
+        debugfs_create_file("heaps", 0400, lunatik_debugfs, NULL,
+                &lunatik_heapsfops);
         return 0;
 }
 
 static void __exit modexit(void)
 {
+        debugfs_remove_recursive(lunatik_debugfs);
+        lunatik_shrinkerexit();
+        lunatik_allocexit();
 }
 
 module_init(modinit);